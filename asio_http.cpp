@@ -20,9 +20,9 @@ int main(int argc, char* argv[])
   try
   {
     // Check command line arguments.
-    if (argc != 5)
+    if (argc != 5 && argc != 6)
     {
-      std::cerr << "Usage: http_server <address> <port> <threads> <doc_root>\n";
+      std::cerr << "Usage: http_server <address> <port> <threads> <doc_root> [shared|sharded]\n";
       std::cerr << "  For IPv4, try:\n";
       std::cerr << "    receiver 0.0.0.0 80 1 .\n";
       std::cerr << "  For IPv6, try:\n";
@@ -32,7 +32,9 @@ int main(int argc, char* argv[])
 
     // Initialize the server.
     std::size_t num_threads = boost::lexical_cast<std::size_t>(argv[3]);
-    http::server::server s(argv[1], argv[2], argv[4], num_threads);
+    http::server::server_options options;
+    options.sharded = argc == 6 && std::string(argv[5]) == "sharded";
+    http::server::server s(argv[1], argv[2], argv[4], num_threads, options);
 
     // Run the server until stopped.
     s.run();
@@ -0,0 +1,106 @@
+//
+// byte_set.cpp
+// ~~~~~~~~~~~~
+//
+
+#include "byte_set.hpp"
+#include <cstring>
+#include <immintrin.h>
+
+namespace http {
+namespace server {
+
+const byte_set::find_function byte_set::find_ = byte_set::choose();
+
+byte_set::byte_set(const char* ranges, std::size_t size)
+  : size_(static_cast<int>(size))
+{
+  std::memset(ranges_, 0, sizeof(ranges_));
+  std::memcpy(ranges_, ranges, size);
+  std::memset(table_, 0, sizeof(table_));
+  for (std::size_t i = 0; i + 1 < size; i += 2)
+  {
+    for (int c = static_cast<unsigned char>(ranges[i]);
+        c <= static_cast<unsigned char>(ranges[i + 1]); ++c)
+      table_[c] = true;
+  }
+}
+
+const char* byte_set::implementation()
+{
+  return find_ == &byte_set::find_avx2 ? "avx2"
+    : find_ == &byte_set::find_sse42 ? "sse4.2" : "scalar";
+}
+
+byte_set::find_function byte_set::choose()
+{
+  // Static initialisers may run before the CPU model is filled in.
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return &byte_set::find_avx2;
+  if (__builtin_cpu_supports("sse4.2"))
+    return &byte_set::find_sse42;
+  return &byte_set::find_scalar;
+}
+
+const char* byte_set::find_scalar(const byte_set& set, const char* begin,
+    const char* end)
+{
+  while (begin != end && !set.table_[static_cast<unsigned char>(*begin)])
+    ++begin;
+  return begin;
+}
+
+__attribute__((target("sse4.2")))
+const char* byte_set::find_sse42(const byte_set& set, const char* begin,
+    const char* end)
+{
+  __m128i ranges = _mm_loadu_si128(reinterpret_cast<const __m128i*>(set.ranges_));
+  while (end - begin >= 16)
+  {
+    __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    int index = _mm_cmpestri(ranges, set.size_, data, 16,
+        _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+    if (index != 16)
+      return begin + index;
+    begin += 16;
+  }
+  return find_scalar(set, begin, end);
+}
+
+__attribute__((target("avx2")))
+const char* byte_set::find_avx2(const byte_set& set, const char* begin,
+    const char* end)
+{
+  // A byte is in a range when its distance above the first byte, wrapping
+  // below zero, is at most the width of the range.
+  int count = set.size_ / 2;
+  __m256i first[8];
+  __m256i width[8];
+  for (int i = 0; i < count; ++i)
+  {
+    first[i] = _mm256_set1_epi8(set.ranges_[2 * i]);
+    width[i] = _mm256_set1_epi8(static_cast<char>(
+          set.ranges_[2 * i + 1] - set.ranges_[2 * i]));
+  }
+
+  while (end - begin >= 32)
+  {
+    __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+    __m256i found = _mm256_setzero_si256();
+    for (int i = 0; i < count; ++i)
+    {
+      __m256i distance = _mm256_sub_epi8(data, first[i]);
+      found = _mm256_or_si256(found, _mm256_cmpeq_epi8(
+            _mm256_min_epu8(distance, width[i]), distance));
+    }
+    unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(found));
+    if (mask != 0)
+      return begin + __builtin_ctz(mask);
+    begin += 32;
+  }
+  return find_sse42(set, begin, end);
+}
+
+} // namespace server
+} // namespace http
@@ -0,0 +1,69 @@
+//
+// byte_set.hpp
+// ~~~~~~~~~~~~
+//
+// Vectorised search for the first byte of a set, used by the parser to take
+// runs of ordinary characters in one go.
+//
+
+#ifndef HTTP_SERVER_BYTE_SET_HPP
+#define HTTP_SERVER_BYTE_SET_HPP
+
+#include <cstddef>
+
+namespace http {
+namespace server {
+
+/// A set of bytes given as up to eight inclusive ranges. The search uses
+/// AVX2 or SSE4.2 when the CPU has them, chosen once at startup, and a table
+/// lookup otherwise.
+class byte_set
+{
+public:
+  /// Construct from pairs of first and last bytes of each range, e.g.
+  /// "\x00\x1f\x7f\x7f" for the control characters.
+  byte_set(const char* ranges, std::size_t size);
+
+  /// The first byte in [begin, end) in the set, or end if there is none.
+  const char* find(const char* begin, const char* end) const
+  {
+    return find_(*this, begin, end);
+  }
+
+  /// Whether the set holds a byte.
+  bool contains(char c) const { return table_[static_cast<unsigned char>(c)]; }
+
+  /// Name of the search in use: "avx2", "sse4.2" or "scalar".
+  static const char* implementation();
+
+private:
+  typedef const char* (*find_function)(const byte_set& set,
+      const char* begin, const char* end);
+
+  static const char* find_scalar(const byte_set& set, const char* begin,
+      const char* end);
+  static const char* find_sse42(const byte_set& set, const char* begin,
+      const char* end);
+  static const char* find_avx2(const byte_set& set, const char* begin,
+      const char* end);
+
+  /// Pick the fastest search the CPU supports.
+  static find_function choose();
+
+  /// The search in use.
+  static const find_function find_;
+
+  /// The ranges, zero padded for loading into a vector register.
+  char ranges_[16];
+
+  /// Number of bytes of ranges_ in use, two per range.
+  int size_;
+
+  /// Membership of each byte value.
+  bool table_[256];
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_SERVER_BYTE_SET_HPP
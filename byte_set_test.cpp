@@ -0,0 +1,86 @@
+//
+// byte_set_test.cpp
+// ~~~~~~~~~~~~~~~~~
+//
+// Checks the search in use against a byte by byte scan, over every length
+// and alignment the vector loops and their tails handle.
+//
+
+#define BOOST_TEST_MODULE byte_set_test
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <cstdlib>
+#include <string>
+#include "byte_set.hpp"
+
+using namespace http::server;
+
+namespace {
+
+/// The first byte in [begin, end) in the set, one byte at a time.
+const char* scan(const byte_set& set, const char* begin, const char* end)
+{
+  while (begin != end && !set.contains(*begin))
+    ++begin;
+  return begin;
+}
+
+/// Random bytes, mostly outside the set so runs are long.
+std::string random_bytes(std::size_t size, const byte_set& set, int one_in)
+{
+  std::string data(size, ' ');
+  for (std::size_t i = 0; i < size; ++i)
+  {
+    char c;
+    do
+      c = static_cast<char>(std::rand() % 256);
+    while (set.contains(c) && std::rand() % one_in != 0);
+    data[i] = c;
+  }
+  return data;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(ranges_hold_their_bounds)
+{
+  byte_set set("\x00\x1f" "::" "\x80\xff", 6);
+  BOOST_CHECK(set.contains('\0'));
+  BOOST_CHECK(set.contains('\x1f'));
+  BOOST_CHECK(!set.contains(' '));
+  BOOST_CHECK(set.contains(':'));
+  BOOST_CHECK(!set.contains(';'));
+  BOOST_CHECK(!set.contains('\x7f'));
+  BOOST_CHECK(set.contains('\x80'));
+  BOOST_CHECK(set.contains('\xff'));
+}
+
+BOOST_AUTO_TEST_CASE(search_matches_a_byte_by_byte_scan)
+{
+  BOOST_TEST_MESSAGE("byte_set search: " << byte_set::implementation());
+  const byte_set sets[] =
+  {
+    byte_set("\r\r", 2),
+    byte_set("\x00\x1f\x7f\x7f", 4),
+    byte_set("\x00\x20" "\"\"" "(),,//:@[]\x7f\xff", 16),
+    byte_set("\x00\x08\x0a\x1f\x7f\x7f", 6)
+  };
+  std::srand(1);
+  for (std::size_t s = 0; s < sizeof(sets) / sizeof(sets[0]); ++s)
+  {
+    for (int round = 0; round < 20; ++round)
+    {
+      std::string data = random_bytes(200, sets[s], 1 + round * 10);
+      for (std::size_t begin = 0; begin < 40; ++begin)
+      {
+        for (std::size_t end = begin; end <= data.size(); end += 1 + end % 7)
+        {
+          const char* b = data.data() + begin;
+          const char* e = data.data() + end;
+          BOOST_REQUIRE_EQUAL(sets[s].find(b, e) - b, scan(sets[s], b, e) - b);
+        }
+      }
+    }
+  }
+}
@@ -10,20 +10,61 @@
 
 #include "connection.hpp"
 #include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/sendfile.h>
+#include <unistd.h>
 #include <boost/bind.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/lexical_cast.hpp>
 #include "request_handler.hpp"
 
 namespace http {
 namespace server {
 
 connection::connection(boost::asio::io_service& io_service,
-    request_handler& handler)
-  : strand_(io_service),
+    request_handler& handler, const server_options& options,
+    bool use_strand, server_stats& stats, const timer_wheel_ptr& wheel)
+  : io_service_(io_service),
+    strand_(use_strand ? new boost::asio::io_service::strand(io_service) : 0),
+    handler_allocator_(stats),
     socket_(io_service),
-    request_handler_(handler)
+    request_handler_(handler),
+    buffer_(stats.read_buffer_bytes),
+    buffer_begin_(0),
+    buffer_end_(0),
+    head_begin_(0),
+    head_end_(0),
+    reply_count_(0),
+    write_index_(0),
+    file_offset_(0),
+    file_remaining_(0),
+    file_part_(0),
+    stream_finished_(false),
+    body_remaining_(0),
+    body_memory_(0),
+    options_(options),
+    requests_served_(0),
+    active_(false),
+    idle_(false),
+    idle_buffer_bytes_(0),
+    requests_in_flight_(0),
+    keep_alive_(true),
+    stats_(stats),
+    timer_wheel_(wheel),
+    deadline_(no_deadline),
+    deadline_generation_(0)
 {
 }
 
+connection::~connection()
+{
+  timer_wheel_->cancel(*this);
+  abandon_replies();
+  release_counts();
+}
+
 boost::asio::ip::tcp::socket& connection::socket()
 {
   return socket_;
@@ -31,45 +72,785 @@ boost::asio::ip::tcp::socket& connection::socket()
 
 void connection::start()
 {
-  socket_.async_read_some(boost::asio::buffer(buffer_),
-      strand_.wrap(
-        boost::bind(&connection::handle_read, shared_from_this(),
-          boost::asio::placeholders::error,
-          boost::asio::placeholders::bytes_transferred)));
+  active_ = true;
+  ++stats_.active_connections;
+  if (options_.release_idle_buffers)
+  {
+    // Reads after waiting for readiness must not block if the data has
+    // gone, asynchronous operations are unaffected.
+    boost::system::error_code ignored_ec;
+    socket_.non_blocking(true, ignored_ec);
+  }
+  start_read();
 }
 
-void connection::handle_read(const boost::system::error_code& e,
-    std::size_t bytes_transferred)
+void connection::reset()
+{
+  timer_wheel_->cancel(*this);
+  deadline_ = no_deadline;
+  boost::system::error_code ignored_ec;
+  socket_.close(ignored_ec);
+  buffer_.release();
+  buffer_begin_ = 0;
+  buffer_end_ = 0;
+  head_begin_ = 0;
+  head_end_ = 0;
+  request_.reset();
+  request_parser_.reset();
+  abandon_replies();
+  body_.reset();
+  body_remaining_ = 0;
+  spill_.reset();
+  std::string().swap(spill_buffer_);
+  stream_.reset();
+  stream_finished_ = false;
+  reply_count_ = 0;
+  write_index_ = 0;
+  file_.reset();
+  file_part_ = 0;
+  requests_served_ = 0;
+  keep_alive_ = true;
+  release_counts();
+}
+
+void connection::release_counts()
+{
+  leave_idle();
+  release_body_memory();
+  stats_.requests_in_flight -= requests_in_flight_;
+  requests_in_flight_ = 0;
+  if (active_)
+  {
+    --stats_.active_connections;
+    active_ = false;
+  }
+}
+
+void connection::set_deadline(deadline_type type)
+{
+  // Cancelling before bumping the generation means any expiry of the old
+  // deadline has already read the old generation.
+  timer_wheel_->cancel(*this);
+  ++deadline_generation_;
+  deadline_ = type;
+
+  std::size_t timeout_ms = 0;
+  switch (type)
+  {
+  case idle_deadline:
+    timeout_ms = options_.idle_timeout_ms;
+    break;
+  case header_deadline:
+    timeout_ms = options_.header_timeout_ms;
+    break;
+  case body_deadline:
+    timeout_ms = options_.body_timeout_ms;
+    break;
+  case write_deadline:
+    timeout_ms = options_.write_timeout_ms;
+    break;
+  case handler_deadline:
+    timeout_ms = options_.handler_timeout_ms;
+    break;
+  default:
+    break;
+  }
+
+  if (timeout_ms != 0)
+    timer_wheel_->schedule(*this, timeout_ms);
+}
+
+void connection::expire()
+{
+  // Only a weak reference is taken here. The wheel's lock is held, and
+  // releasing the last reference to the connection would cancel its deadline
+  // and take the lock again.
+  auto handler = boost::bind(&connection::handle_expired,
+      boost::weak_ptr<connection>(weak_from_this()), deadline_generation_.load());
+  if (strand_)
+    strand_->post(handler);
+  else
+    io_service_.post(handler);
+}
+
+void connection::handle_expired(const boost::weak_ptr<connection>& c,
+    std::size_t generation)
+{
+  connection_ptr self = c.lock();
+  if (self)
+    self->handle_timeout(generation);
+}
+
+void connection::handle_timeout(std::size_t generation)
+{
+  if (generation != deadline_generation_)
+    return;
+
+  switch (deadline_)
+  {
+  case idle_deadline:
+    ++stats_.idle_timeouts;
+    break;
+  case header_deadline:
+    ++stats_.header_timeouts;
+    break;
+  case body_deadline:
+    ++stats_.body_timeouts;
+    break;
+  case write_deadline:
+    ++stats_.write_timeouts;
+    break;
+  case handler_deadline:
+    ++stats_.handler_timeouts;
+    break;
+  default:
+    return;
+  }
+
+  // Closing the socket aborts the outstanding operation, whose handler then
+  // starts nothing new and the connection is released. A connection waiting
+  // for a streamed body or a deferred reply has no operation outstanding,
+  // abandoning the replies lets go of it instead.
+  deadline_ = no_deadline;
+  boost::system::error_code ignored_ec;
+  socket_.close(ignored_ec);
+  abandon_replies();
+}
+
+void connection::start_read()
+{
+  // Header and body deadlines run from the start of their phase rather than
+  // from each read, so a client can not dribble a request in forever.
+  deadline_type type = !request_parser_.started() ? idle_deadline
+    : request_parser_.in_body() ? body_deadline : header_deadline;
+  if (type != deadline_)
+    set_deadline(type);
+
+  // Between requests nothing is buffered. Waiting for the socket to become
+  // readable before taking a buffer means an idle connection holds none.
+  bool idle = !request_parser_.started() && buffer_begin_ == buffer_end_;
+  if (idle && options_.release_idle_buffers)
+  {
+    buffer_begin_ = 0;
+    buffer_end_ = 0;
+    buffer_.release();
+    enter_idle();
+    start_wait();
+    return;
+  }
+
+  // The head of a request still being handled is kept, moved to the front
+  // to make room. Once its body has started the rest of the buffer has been
+  // consumed.
+  buffer_.acquire();
+  std::size_t keep = buffer_begin_;
+  std::size_t keep_end = buffer_end_;
+  if (request_parser_.started())
+  {
+    keep = head_begin_;
+    if (request_parser_.in_body())
+      keep_end = head_end_;
+  }
+  if (keep != 0)
+  {
+    std::memmove(buffer_.data(), buffer_.data() + keep, keep_end - keep);
+    request_.relocate(buffer_.data() + keep, keep_end - keep, buffer_.data());
+  }
+  head_begin_ = 0;
+  head_end_ -= std::min(head_end_, keep);
+  buffer_end_ = keep_end - keep;
+  buffer_begin_ = std::min(buffer_begin_ - keep, buffer_end_);
+
+  if (buffer_end_ == buffer_.size())
+  {
+    // Only a head filling the buffer gets here, it is smaller than the
+    // largest allowed until the body has started.
+    std::size_t size = buffer_.size() * 2;
+    if (!request_parser_.in_body())
+      size = std::min(size, options_.max_header_size);
+    const char* old = buffer_.data();
+    buffer_.resize(size, buffer_end_);
+    request_.relocate(old, buffer_end_, buffer_.data());
+  }
+  else if (!request_parser_.started() && buffer_end_ <= read_buffer::slab_size
+      && buffer_.size() != read_buffer::slab_size)
+  {
+    // A buffer grown for a large head goes back to a slab between requests.
+    buffer_.resize(read_buffer::slab_size, buffer_end_);
+  }
+
+  if (idle)
+    enter_idle();
+
+  auto handler = make_custom_alloc_handler(handler_allocator_,
+      boost::bind(&connection::handle_read, shared_from_this(),
+        boost::asio::placeholders::error,
+        boost::asio::placeholders::bytes_transferred));
+  boost::asio::mutable_buffers_1 free_space = boost::asio::buffer(
+      buffer_.data() + buffer_end_, buffer_.size() - buffer_end_);
+  if (strand_)
+    socket_.async_read_some(free_space, strand_->wrap(handler));
+  else
+    socket_.async_read_some(free_space, handler);
+}
+
+void connection::start_wait()
+{
+  auto handler = make_custom_alloc_handler(handler_allocator_,
+      boost::bind(&connection::handle_ready, shared_from_this(),
+        boost::asio::placeholders::error));
+  if (strand_)
+    socket_.async_wait(boost::asio::ip::tcp::socket::wait_read,
+        strand_->wrap(handler));
+  else
+    socket_.async_wait(boost::asio::ip::tcp::socket::wait_read, handler);
+}
+
+void connection::enter_idle()
+{
+  idle_ = true;
+  idle_buffer_bytes_ = buffer_.size();
+  ++stats_.idle_connections;
+  stats_.idle_read_buffer_bytes += idle_buffer_bytes_;
+}
+
+void connection::leave_idle()
+{
+  if (!idle_)
+    return;
+  idle_ = false;
+  --stats_.idle_connections;
+  stats_.idle_read_buffer_bytes -= idle_buffer_bytes_;
+}
+
+void connection::start_write()
+{
+  // A span of a file body ends the batch, the file follows the buffers. A
+  // reply part way through its parts carries on where it left off.
+  write_buffers_.clear();
+  bool file_span = file_part_ != 0 && next_file_span(replies_[write_index_ - 1]);
+  while (!file_span && write_index_ < reply_count_)
+  {
+    reply& rep = replies_[write_index_];
+    if (rep.deferred)
+    {
+      // A reply still being produced ends the batch. With nothing else to
+      // write the connection waits for it without an operation outstanding,
+      // held by the deferred reply until it completes or is cancelled.
+      deferred_reply_ptr deferred = rep.deferred;
+      bool waiting = write_buffers_.empty();
+      if (!deferred->take(rep, waiting
+            ? boost::function<void()>(boost::bind(&connection::notify_deferred, shared_from_this()))
+            : boost::function<void()>()))
+      {
+        if (waiting)
+        {
+          set_deadline(handler_deadline);
+          return;
+        }
+        break;
+      }
+    }
+    ++write_index_;
+    rep.append_buffers(write_buffers_);
+    if (rep.stream)
+    {
+      // A streamed body ends the batch, it is sent as it is produced.
+      stream_ = rep.stream;
+      break;
+    }
+    file_span = rep.file && next_file_span(rep);
+  }
+
+  set_deadline(write_deadline);
+
+  auto handler = make_custom_alloc_handler(handler_allocator_,
+      boost::bind(&connection::handle_write, shared_from_this(),
+        boost::asio::placeholders::error));
+  if (strand_)
+    boost::asio::async_write(socket_, write_buffers_, strand_->wrap(handler));
+  else
+    boost::asio::async_write(socket_, write_buffers_, handler);
+}
+
+bool connection::next_file_span(reply& rep)
+{
+  if (rep.parts.empty())
+  {
+    file_offset_ = rep.file->offset;
+    file_remaining_ = rep.file->length;
+    if (file_remaining_ == 0)
+      return false;
+    file_ = rep.file;
+    return true;
+  }
+
+  while (file_part_ < rep.parts.size())
+  {
+    const reply::body_part& part = rep.parts[file_part_++];
+    if (!part.header.empty())
+      write_buffers_.push_back(boost::asio::buffer(part.header));
+    if (part.length != 0)
+    {
+      file_ = rep.file;
+      file_offset_ = part.offset;
+      file_remaining_ = part.length;
+      return true;
+    }
+  }
+  write_buffers_.push_back(boost::asio::buffer(rep.content));
+  file_part_ = 0;
+  return false;
+}
+
+void connection::send_file()
+{
+  set_deadline(write_deadline);
+
+  boost::system::error_code ec;
+  socket_.native_non_blocking(true, ec);
+  off_t offset = file_offset_;
+  ssize_t n = ::sendfile(socket_.native_handle(), file_->descriptor(), &offset,
+      std::min(file_remaining_, options_.sendfile_chunk_size));
+  if (n > 0)
+  {
+    file_offset_ += n;
+    file_remaining_ -= n;
+    if (file_remaining_ == 0)
+    {
+      file_.reset();
+      handle_write(ec);
+      return;
+    }
+  }
+  else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+  {
+    // The file shrank underneath us or the client went away. The reply can
+    // not be completed, so the connection is dropped.
+    socket_.close(ec);
+    return;
+  }
+
+  // Yield to other connections between chunks, then carry on once the socket
+  // can take more.
+  auto handler = make_custom_alloc_handler(handler_allocator_,
+      boost::bind(&connection::handle_file_writable, shared_from_this(),
+        boost::asio::placeholders::error));
+  if (strand_)
+    socket_.async_write_some(boost::asio::null_buffers(), strand_->wrap(handler));
+  else
+    socket_.async_write_some(boost::asio::null_buffers(), handler);
+}
+
+void connection::handle_file_writable(const boost::system::error_code& e)
 {
   if (!e)
   {
+    send_file();
+  }
+}
+
+void connection::send_stream()
+{
+  set_deadline(write_deadline);
+
+  // The stream holds the connection while waiting, and lets go of it once
+  // it calls back or is closed. The write deadline bounds the wait for a
+  // producer that has gone quiet.
+  if (!stream_->take(stream_buffer_, stream_finished_,
+        boost::bind(&connection::notify_stream, shared_from_this())))
+    return;
+
+  if (stream_buffer_.empty())
+  {
+    handle_stream_write(boost::system::error_code());
+    return;
+  }
+
+  auto handler = make_custom_alloc_handler(handler_allocator_,
+      boost::bind(&connection::handle_stream_write, shared_from_this(),
+        boost::asio::placeholders::error));
+  if (strand_)
+    boost::asio::async_write(socket_, boost::asio::buffer(stream_buffer_), strand_->wrap(handler));
+  else
+    boost::asio::async_write(socket_, boost::asio::buffer(stream_buffer_), handler);
+}
+
+void connection::notify_stream()
+{
+  auto handler = boost::bind(&connection::send_stream, shared_from_this());
+  if (strand_)
+    strand_->post(handler);
+  else
+    io_service_.post(handler);
+}
+
+void connection::handle_stream_write(const boost::system::error_code& e)
+{
+  if (e)
+  {
+    // The connection is released and closes the stream on the way.
+    return;
+  }
+
+  stream_->sent();
+  if (stream_finished_)
+  {
+    stream_.reset();
+    stream_finished_ = false;
+    handle_write(e);
+    return;
+  }
+  send_stream();
+}
+
+void connection::notify_deferred()
+{
+  auto handler = boost::bind(&connection::start_write, shared_from_this());
+  if (strand_)
+    strand_->post(handler);
+  else
+    io_service_.post(handler);
+}
+
+void connection::abandon_replies()
+{
+  for (std::size_t i = 0; i < reply_count_; ++i)
+  {
+    if (replies_[i].stream)
+      replies_[i].stream->close();
+    if (replies_[i].deferred)
+      replies_[i].deferred->cancel();
+  }
+  if (body_)
+    body_->abort();
+}
+
+void connection::process_buffer()
+{
+  // The rest of a streamed body is read whatever becomes of the connection
+  // afterwards.
+  while (buffer_begin_ != buffer_end_ && (body_ || (keep_alive_
+        && reply_count_ < options_.max_pipelined_replies)))
+  {
+    if (body_)
+    {
+      if (!deliver_body())
+        return;
+      continue;
+    }
+    if (spill_)
+    {
+      spill_body();
+      continue;
+    }
+
+    if (!request_parser_.started())
+      head_begin_ = buffer_begin_;
+
     boost::tribool result;
-    boost::tie(result, boost::tuples::ignore) = request_parser_.parse(request_, buffer_.data(), buffer_.data() + bytes_transferred);
+    char* consumed;
+    boost::tie(result, consumed) = request_parser_.parse(request_,
+        buffer_.data() + buffer_begin_, buffer_.data() + buffer_end_);
+    buffer_begin_ = consumed - buffer_.data();
 
     if (result)
     {
-      request_handler_.handle_request(request_, reply_);
-      boost::asio::async_write(socket_, reply_.to_buffers(),
-          strand_.wrap(
-            boost::bind(&connection::handle_write, shared_from_this(),
-              boost::asio::placeholders::error)));
+      dispatch_request();
+      release_body_memory();
+      request_.reset();
+      request_parser_.reset();
     }
     else if (!result)
     {
-      reply_ = reply::stock_reply(reply::bad_request);
-      boost::asio::async_write(socket_, reply_.to_buffers(),
-          strand_.wrap(
-            boost::bind(&connection::handle_write, shared_from_this(),
-              boost::asio::placeholders::error)));
+      // The stream can not be resynchronised after a malformed request, nor
+      // after a body whose framing is not understood.
+      reply& rep = next_reply();
+      rep = reply::stock_reply(request_parser_.unsupported()
+          ? reply::not_implemented : reply::bad_request);
+      set_keep_alive(rep, false);
     }
-    else
+    else if (request_parser_.at_body_start())
     {
-      socket_.async_read_some(boost::asio::buffer(buffer_),
-          strand_.wrap(
-            boost::bind(&connection::handle_read, shared_from_this(),
-              boost::asio::placeholders::error,
-              boost::asio::placeholders::bytes_transferred)));
+      head_end_ = buffer_begin_;
+      start_body(request_parser_.body_remaining());
     }
+    else if (!request_parser_.in_body()
+        && buffer_begin_ - head_begin_ >= options_.max_header_size)
+    {
+      // The head is kept whole in the buffer, which is not allowed to grow
+      // without bound. A body collected in memory is limited on its own.
+      ++stats_.oversized_heads;
+      reply& rep = next_reply();
+      rep = reply::stock_reply(reply::request_header_fields_too_large);
+      set_keep_alive(rep, false);
+    }
+  }
+
+  if (body_ || spill_)
+  {
+    // Only reached once the buffer is used up.
+    start_read();
+  }
+  else if (reply_count_ != 0)
+  {
+    start_write();
+  }
+  else
+  {
+    start_read();
+  }
+}
+
+void connection::dispatch_request()
+{
+  ++requests_served_;
+  reply& rep = next_reply();
+  ++requests_in_flight_;
+  std::size_t in_flight = ++stats_.requests_in_flight;
+  if (options_.max_requests_in_flight != 0
+      && in_flight > options_.max_requests_in_flight)
+  {
+    ++stats_.requests_shed;
+    rep = reply::stock_reply(reply::service_unavailable);
+    rep.headers.insert(std::make_pair(std::string("Retry-After"),
+          boost::lexical_cast<std::string>(options_.retry_after_seconds)));
+  }
+  else
+  {
+    request_handler_.handle_request(request_, rep, io_service_);
+  }
+  set_keep_alive(rep, keep_alive_requested());
+}
+
+void connection::start_body(std::size_t length)
+{
+  // The length is only the client's word, nothing is set aside for the body
+  // before it is checked.
+  if (options_.max_body_size != 0 && length > options_.max_body_size)
+  {
+    refuse_body(reply::payload_too_large);
+    return;
+  }
+
+  // Only handlers asking for it get a body in a file. Form bodies stay in
+  // memory whatever their size, their parameters are parsed from them.
+  bool form = request_.headers.value(content_type_header).find(
+      "x-www-form-urlencoded") != boost::string_ref::npos;
+  if (request_handler_.streams_body(request_))
+  {
+    stream_body(length);
+    return;
+  }
+  if (!form && request_handler_.spills_body(request_)
+      && (length > options_.body_spill_threshold
+        || (options_.max_body_memory != 0
+          && stats_.request_body_bytes + length > options_.max_body_memory))
+      && start_spill())
+  {
+    body_remaining_ = length;
+    return;
+  }
+
+  // Whatever stays in memory is counted before the parser reserves room
+  // for it.
+  std::size_t held = stats_.request_body_bytes += length;
+  if (options_.max_body_memory != 0 && held > options_.max_body_memory)
+  {
+    stats_.request_body_bytes -= length;
+    refuse_body(length > options_.max_body_memory
+        ? reply::payload_too_large : reply::service_unavailable);
+    return;
+  }
+  body_memory_ = length;
+}
+
+void connection::refuse_body(reply::status_type status)
+{
+  ++stats_.refused_bodies;
+  reply& rep = next_reply();
+  rep = reply::stock_reply(status);
+  if (status == reply::service_unavailable)
+    rep.headers.insert(std::make_pair(std::string("Retry-After"),
+          boost::lexical_cast<std::string>(options_.retry_after_seconds)));
+  set_keep_alive(rep, false);
+}
+
+bool connection::start_spill()
+{
+  spill_ = file_body::temporary(options_.body_spill_directory);
+  if (!spill_)
+    return false;
+  ++stats_.spilled_request_bodies;
+  spill_->length = 0;
+  spill_buffer_.reserve(options_.body_spill_buffer_size);
+  return true;
+}
+
+void connection::spill_body()
+{
+  std::size_t size = std::min(body_remaining_, buffer_end_ - buffer_begin_);
+  spill_buffer_.append(buffer_.data() + buffer_begin_, size);
+  buffer_begin_ += size;
+  body_remaining_ -= size;
+  if (spill_buffer_.size() < options_.body_spill_buffer_size
+      && body_remaining_ != 0)
+    return;
+
+  if (!write_spill())
+  {
+    // The body can not be kept. The request is answered with an error and
+    // the connection closed rather than the rest of the body read.
+    spill_.reset();
+    std::string().swap(spill_buffer_);
+    reply& rep = next_reply();
+    rep = reply::stock_reply(reply::internal_server_error);
+    set_keep_alive(rep, false);
+    return;
+  }
+
+  if (body_remaining_ == 0)
+  {
+    // The buffer is only wanted while a body is being written.
+    std::string().swap(spill_buffer_);
+    request_.post_file.swap(spill_);
+    spill_.reset();
+    dispatch_request();
+    request_.reset();
+    request_parser_.reset();
+  }
+}
+
+bool connection::write_spill()
+{
+  const char* data = spill_buffer_.data();
+  std::size_t size = spill_buffer_.size();
+  while (size != 0)
+  {
+    ssize_t n = ::write(spill_->descriptor(), data, size);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+  spill_->length += spill_buffer_.size();
+  spill_buffer_.clear();
+  return true;
+}
+
+void connection::release_body_memory()
+{
+  stats_.request_body_bytes -= body_memory_;
+  body_memory_ = 0;
+}
+
+void connection::stream_body(std::size_t length)
+{
+  // The handler is called before the body is read. A request answered
+  // straight away, shed, not modified or by a handler that took no interest
+  // in the body, has its body read and dropped.
+  ++stats_.streamed_request_bodies;
+  body_.reset(new request_body(length));
+  body_remaining_ = length;
+  request_.body = body_;
+  dispatch_request();
+  if (!replies_[reply_count_ - 1].deferred)
+    body_->discard_unclaimed();
+}
+
+bool connection::deliver_body()
+{
+  // The body holds the connection while it waits for the consumer, and lets
+  // go of it once the consumer is ready or the body is aborted.
+  if (!body_->ready() && body_->wait(
+        boost::bind(&connection::notify_body, shared_from_this())))
+  {
+    if (deadline_ != body_deadline)
+      set_deadline(body_deadline);
+    return false;
+  }
+
+  std::size_t size = std::min(body_remaining_, buffer_end_ - buffer_begin_);
+  body_->deliver(buffer_.data() + buffer_begin_, size);
+  buffer_begin_ += size;
+  body_remaining_ -= size;
+  if (body_remaining_ == 0)
+    finish_body();
+  return true;
+}
+
+void connection::finish_body()
+{
+  request_body_ptr body;
+  body.swap(body_);
+  request_.reset();
+  request_parser_.reset();
+  body->end();
+}
+
+void connection::notify_body()
+{
+  auto handler = boost::bind(&connection::process_buffer, shared_from_this());
+  if (strand_)
+    strand_->post(handler);
+  else
+    io_service_.post(handler);
+}
+
+reply& connection::next_reply()
+{
+  if (reply_count_ == replies_.size())
+    replies_.push_back(reply());
+  reply& rep = replies_[reply_count_++];
+  rep.reset();
+  return rep;
+}
+
+bool connection::keep_alive_requested() const
+{
+  // HTTP/1.1 connections persist unless the client asks otherwise, HTTP/1.0
+  // connections only persist when the client explicitly asks for it.
+  bool persistent = request_.http_version_major > 1
+    || (request_.http_version_major == 1 && request_.http_version_minor >= 1);
+  request_fields::const_iterator header = request_.headers.find(connection_header);
+  if (header != request_.headers.end())
+  {
+    if (boost::algorithm::iequals(header->second, "close"))
+      persistent = false;
+    else if (boost::algorithm::iequals(header->second, "keep-alive"))
+      persistent = true;
+  }
+
+  if (options_.max_keep_alive_requests != 0
+      && requests_served_ >= options_.max_keep_alive_requests)
+    persistent = false;
+
+  return persistent;
+}
+
+void connection::set_keep_alive(reply& rep, bool keep_alive)
+{
+  // Without chunked transfer-coding a streamed body ends when the connection
+  // is closed.
+  keep_alive_ = keep_alive && !(rep.stream && !rep.stream->chunked());
+  rep.headers.erase("Connection");
+  rep.headers.insert(std::make_pair(std::string("Connection"),
+        std::string(keep_alive_ ? "keep-alive" : "close")));
+}
+
+void connection::handle_read(const boost::system::error_code& e,
+    std::size_t bytes_transferred)
+{
+  leave_idle();
+  if (!e)
+  {
+    buffer_begin_ = buffer_end_;
+    buffer_end_ += bytes_transferred;
+    process_buffer();
   }
 
   // If an error occurs then no new asynchronous operations are started. This
@@ -78,15 +859,72 @@ void connection::handle_read(const boost::system::error_code& e,
   // handler returns. The connection class's destructor closes the socket.
 }
 
+void connection::handle_ready(const boost::system::error_code& e)
+{
+  leave_idle();
+  if (e)
+    return;
+
+  buffer_.acquire();
+  boost::system::error_code ec;
+  std::size_t n = socket_.read_some(
+      boost::asio::buffer(buffer_.data(), buffer_.size()), ec);
+  if (ec == boost::asio::error::would_block)
+  {
+    // Woken without data, the buffer goes back while waiting again.
+    start_read();
+    return;
+  }
+  handle_read(ec, n);
+}
+
 void connection::handle_write(const boost::system::error_code& e)
 {
   if (!e)
   {
-    // Initiate graceful connection closure.
-    boost::system::error_code ignored_ec;
-    socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored_ec);
+    if (file_)
+    {
+      send_file();
+    }
+    else if (stream_)
+    {
+      send_stream();
+    }
+    else if (file_part_ != 0 || write_index_ < reply_count_)
+    {
+      start_write();
+    }
+    else
+    {
+      finish_replies();
+    }
   }
 
+  // If an error occurs then no new asynchronous operations are started. This
+  // means that all shared_ptr references to the connection object will
+  // disappear and the object will be destroyed automatically after this
+  // handler returns. The connection class's destructor closes the socket.
+}
+
+void connection::finish_replies()
+{
+  stats_.requests_in_flight -= requests_in_flight_;
+  requests_in_flight_ = 0;
+  reply_count_ = 0;
+  write_index_ = 0;
+
+  if (keep_alive_)
+  {
+    // Pipelined requests already in the buffer are answered before any
+    // further data is read from the client.
+    process_buffer();
+    return;
+  }
+
+  // Initiate graceful connection closure.
+  boost::system::error_code ignored_ec;
+  socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored_ec);
+
   // No new asynchronous operations are started. This means that all shared_ptr
   // references to the connection object will disappear and the object will be
   // destroyed automatically after this handler returns. The connection class's
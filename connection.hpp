@@ -11,15 +11,22 @@
 #ifndef HTTP_SERVER_CONNECTION_HPP
 #define HTTP_SERVER_CONNECTION_HPP
 
+#include <vector>
 #include <boost/asio.hpp>
-#include <boost/array.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
+#include "handler_allocator.hpp"
+#include "read_buffer.hpp"
 #include "reply.hpp"
-#include "request.hpp"
+#include "request_view.hpp"
 #include "request_handler.hpp"
 #include "request_parser.hpp"
+#include "server_options.hpp"
+#include "server_stats.hpp"
+#include "timer_wheel.hpp"
 
 namespace http {
 namespace server {
@@ -27,12 +34,18 @@ namespace server {
 /// Represents a single connection from a client.
 class connection
   : public boost::enable_shared_from_this<connection>,
-    private boost::noncopyable
+    private timer_wheel::entry
 {
 public:
-  /// Construct a connection with the given io_service.
+  /// Construct a connection with the given io_service. A strand is only
+  /// needed when the io_service is run by more than one thread. Deadlines
+  /// are enforced by the given timer wheel.
   explicit connection(boost::asio::io_service& io_service,
-      request_handler& handler);
+      request_handler& handler, const server_options& options,
+      bool use_strand, server_stats& stats, const timer_wheel_ptr& wheel);
+
+  /// Destroy the connection, removing any deadline from the wheel.
+  ~connection();
 
   /// Get the socket associated with the connection.
   boost::asio::ip::tcp::socket& socket();
@@ -40,16 +53,173 @@ public:
   /// Start the first asynchronous operation for the connection.
   void start();
 
+  /// Close the socket and clear all per-client state so the connection can
+  /// be accepted into again. Buffer and string capacity are retained.
+  void reset();
+
 private:
+  /// The deadline currently armed for the connection.
+  enum deadline_type
+  {
+    no_deadline,
+    idle_deadline,
+    header_deadline,
+    body_deadline,
+    write_deadline,
+    handler_deadline
+  };
+
+  /// Arm the given deadline, replacing any other. The timeout for the type
+  /// comes from the server options.
+  void set_deadline(deadline_type type);
+
+  /// Called by the timer wheel when the armed deadline passes.
+  void expire();
+
+  /// Forward an expiry to the connection if it is still alive.
+  static void handle_expired(const boost::weak_ptr<connection>& c,
+      std::size_t generation);
+
+  /// Close the connection if the deadline that expired is still current.
+  void handle_timeout(std::size_t generation);
+
+  /// Give back the connection's share of the server wide connection and
+  /// request counts.
+  void release_counts();
+
+  /// Initiate an asynchronous read into the buffer.
+  void start_read();
+
+  /// Wait for the socket to become readable without holding a buffer.
+  void start_wait();
+
+  /// Count the connection as idle, waiting for a request with nothing
+  /// buffered.
+  void enter_idle();
+
+  /// Stop counting the connection as idle.
+  void leave_idle();
+
+  /// Initiate a single gathered asynchronous write of the queued replies, up
+  /// to and including the headers of the first span of a file body, and up
+  /// to the first reply still being produced.
+  void start_write();
+
+  /// Move on to the next span of the file body of a reply, appending any
+  /// bytes that precede it to the write buffers. Returns false once the body
+  /// is complete, after appending whatever follows its last span.
+  bool next_file_span(reply& rep);
+
+  /// Send the next chunk of the current file body with sendfile, waiting for
+  /// the socket to become writable when it is full.
+  void send_file();
+
+  /// Handle the socket becoming writable while sending a file body.
+  void handle_file_writable(const boost::system::error_code& e);
+
+  /// Send whatever the producer of the current streamed body has queued,
+  /// or wait for it to queue more.
+  void send_stream();
+
+  /// Ask for send_stream to be called on the connection's io thread, used
+  /// by the stream once data is queued.
+  void notify_stream();
+
+  /// Handle completion of a write of streamed data.
+  void handle_stream_write(const boost::system::error_code& e);
+
+  /// Ask for start_write to be called on the connection's io thread, used
+  /// by a deferred reply once it completes.
+  void notify_deferred();
+
+  /// Close the streams and cancel the deferred replies of every queued
+  /// reply, and abort the request body being streamed, so their producers
+  /// and consumers stop.
+  void abandon_replies();
+
+  /// Called once every queued reply has been written.
+  void finish_replies();
+
+  /// Parse and dispatch the requests held in the unconsumed part of the
+  /// buffer, then either write the resulting replies or read more data.
+  void process_buffer();
+
+  /// Hand the request just parsed to the request handler, or shed it when
+  /// too many requests are in flight, queueing its reply.
+  void dispatch_request();
+
+  /// Decide where the body of the given length of a request whose headers
+  /// have just arrived goes: streamed to its handler, written to a
+  /// temporary file, or collected in memory by the parser.
+  void start_body(std::size_t length);
+
+  /// Answer the current request with an error instead of reading its body,
+  /// and close the connection once the reply is written.
+  void refuse_body(reply::status_type status);
+
+  /// Create the temporary file for the body of the current request. Returns
+  /// false if it can not be created.
+  bool start_spill();
+
+  /// Move the buffered part of a body being written to a temporary file to
+  /// the spill buffer, writing the buffer out once full, and dispatch the
+  /// request once the whole body is written.
+  void spill_body();
+
+  /// Write out the spill buffer. Returns false on error.
+  bool write_spill();
+
+  /// Give back the body bytes of the current request counted as held in
+  /// memory.
+  void release_body_memory();
+
+  /// Dispatch a request whose headers have arrived, to be followed by a body
+  /// of the given length streamed to its handler.
+  void stream_body(std::size_t length);
+
+  /// Pass the buffered part of the streamed body to its consumer. Returns
+  /// false when the consumer is not ready for it, leaving the connection
+  /// waiting without an operation outstanding.
+  bool deliver_body();
+
+  /// Tell the consumer the whole streamed body has been delivered, ready to
+  /// parse the next request.
+  void finish_body();
+
+  /// Ask for process_buffer to be called on the connection's io thread, used
+  /// by a streamed request body once its consumer is ready.
+  void notify_body();
+
+  /// Get a cleared reply object at the back of the reply queue.
+  reply& next_reply();
+
+  /// Whether the client and configuration allow the connection to stay open
+  /// after the reply to the current request.
+  bool keep_alive_requested() const;
+
+  /// Record whether the connection stays open after the given reply and mark
+  /// the reply with the matching Connection header.
+  void set_keep_alive(reply& rep, bool keep_alive);
+
   /// Handle completion of a read operation.
   void handle_read(const boost::system::error_code& e,
       std::size_t bytes_transferred);
 
+  /// Handle the socket becoming readable, reading what has arrived.
+  void handle_ready(const boost::system::error_code& e);
+
   /// Handle completion of a write operation.
   void handle_write(const boost::system::error_code& e);
 
-  /// Strand to ensure the connection's handlers are not called concurrently.
-  boost::asio::io_service::strand strand_;
+  /// The io_service the connection runs on.
+  boost::asio::io_service& io_service_;
+
+  /// Strand to ensure the connection's handlers are not called concurrently,
+  /// null when the io_service is run by a single thread.
+  boost::scoped_ptr<boost::asio::io_service::strand> strand_;
+
+  /// Memory for the completion handlers of the connection's operations.
+  handler_allocator handler_allocator_;
 
   /// Socket for the connection.
   boost::asio::ip::tcp::socket socket_;
@@ -57,17 +227,113 @@ private:
   /// The handler used to process the incoming request.
   request_handler& request_handler_;
 
-  /// Buffer for incoming data.
-  boost::array<char, 8192> buffer_;
+  /// Buffer for incoming data. The request views the bytes of its head here,
+  /// so the buffer grows rather than drop them when a head does not fit.
+  read_buffer buffer_;
+
+  /// Offset of the first byte in the buffer not yet consumed by the parser.
+  std::size_t buffer_begin_;
+
+  /// Offset one past the last byte of data held in the buffer.
+  std::size_t buffer_end_;
+
+  /// Offset of the head of the request being parsed.
+  std::size_t head_begin_;
+
+  /// Offset one past the end of the head, once the body has started.
+  std::size_t head_end_;
 
   /// The incoming request.
-  request request_;
+  request_view request_;
 
   /// The parser for the incoming request.
   request_parser request_parser_;
 
-  /// The reply to be sent back to the client.
-  reply reply_;
+  /// Replies waiting to be written, in request order. Entries past
+  /// reply_count_ are kept so their storage can be reused.
+  std::vector<reply> replies_;
+
+  /// Number of live entries in replies_.
+  std::size_t reply_count_;
+
+  /// Number of queued replies whose headers have been written.
+  std::size_t write_index_;
+
+  /// The file body being sent, null when none is.
+  file_body_ptr file_;
+
+  /// Offset in the file of the next byte to send.
+  std::size_t file_offset_;
+
+  /// Bytes of the file body still to send.
+  std::size_t file_remaining_;
+
+  /// Index of the next part of the file body being sent in parts, zero when
+  /// no reply is part way through its parts.
+  std::size_t file_part_;
+
+  /// The streamed body being sent, null when none is.
+  reply_stream_ptr stream_;
+
+  /// Streamed data being written.
+  std::string stream_buffer_;
+
+  /// Whether stream_buffer_ holds the end of the streamed body.
+  bool stream_finished_;
+
+  /// The request body being streamed to its handler, null when none is.
+  request_body_ptr body_;
+
+  /// Bytes of the streamed or spilled request body still to be read.
+  std::size_t body_remaining_;
+
+  /// Bytes of the current request's body counted as held in memory.
+  std::size_t body_memory_;
+
+  /// The temporary file the request body is being written to, null when
+  /// none is.
+  file_body_ptr spill_;
+
+  /// Body data waiting to be written to the temporary file.
+  std::string spill_buffer_;
+
+  /// Buffers for the gathered write of all queued replies.
+  std::vector<boost::asio::const_buffer> write_buffers_;
+
+  /// Server wide configuration.
+  const server_options& options_;
+
+  /// Number of requests answered on this connection so far.
+  std::size_t requests_served_;
+
+  /// Whether the connection is counted in the active connections.
+  bool active_;
+
+  /// Whether the connection is counted in the idle connections.
+  bool idle_;
+
+  /// Bytes of read buffer counted as held by the idle connection.
+  std::size_t idle_buffer_bytes_;
+
+  /// Number of queued replies counted in the requests in flight.
+  std::size_t requests_in_flight_;
+
+  /// Whether the connection is kept open once the queued replies are written.
+  bool keep_alive_;
+
+  /// Counters for timeouts.
+  server_stats& stats_;
+
+  /// The wheel holding the connection's deadline. Shared so it outlives
+  /// connections released while their io_service is destroyed.
+  timer_wheel_ptr timer_wheel_;
+
+  /// The deadline currently armed.
+  deadline_type deadline_;
+
+  /// Changed whenever the deadline is re-armed, so an expiry that raced with
+  /// re-arming is ignored.
+  std::atomic<std::size_t> deadline_generation_;
 };
 
 typedef boost::shared_ptr<connection> connection_ptr;
@@ -0,0 +1,81 @@
+//
+// connection_pool.cpp
+// ~~~~~~~~~~~~~~~~~~~
+//
+
+#include "connection_pool.hpp"
+#include <boost/bind.hpp>
+
+namespace http {
+namespace server {
+
+connection_pool::connection_pool(boost::asio::io_service& io_service,
+    request_handler& handler, const server_options& options,
+    bool use_strand, server_stats& stats, const timer_wheel_ptr& wheel)
+  : io_service_(io_service),
+    request_handler_(handler),
+    options_(options),
+    use_strand_(use_strand),
+    stats_(stats),
+    timer_wheel_(wheel)
+{
+}
+
+connection_pool::~connection_pool()
+{
+  for (connection* c : idle_)
+    delete c;
+}
+
+connection_ptr connection_pool::acquire()
+{
+  connection* c = 0;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (!idle_.empty())
+    {
+      c = idle_.back();
+      idle_.pop_back();
+    }
+  }
+
+  if (c)
+  {
+    ++stats_.connection_pool_hits;
+  }
+  else
+  {
+    ++stats_.connection_pool_misses;
+    c = new connection(io_service_, request_handler_, options_, use_strand_, stats_, timer_wheel_);
+  }
+
+  return connection_ptr(c, boost::bind(&connection_pool::release,
+        boost::weak_ptr<connection_pool>(shared_from_this()), _1));
+}
+
+std::size_t connection_pool::idle_count()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return idle_.size();
+}
+
+void connection_pool::release(const boost::weak_ptr<connection_pool>& pool,
+    connection* c)
+{
+  connection_pool_ptr p = pool.lock();
+  if (p)
+  {
+    c->reset();
+    boost::mutex::scoped_lock lock(p->mutex_);
+    if (p->idle_.size() < p->options_.connection_pool_size)
+    {
+      p->idle_.push_back(c);
+      return;
+    }
+  }
+
+  delete c;
+}
+
+} // namespace server
+} // namespace http
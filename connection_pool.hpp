@@ -0,0 +1,83 @@
+//
+// connection_pool.hpp
+// ~~~~~~~~~~~~~~~~~~~
+//
+// Recycles connection objects so their buffers and string capacity are
+// reused by the next client instead of being freed after every connection.
+//
+
+#ifndef HTTP_SERVER_CONNECTION_POOL_HPP
+#define HTTP_SERVER_CONNECTION_POOL_HPP
+
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include "connection.hpp"
+#include "server_options.hpp"
+#include "server_stats.hpp"
+#include "timer_wheel.hpp"
+
+namespace http {
+namespace server {
+
+/// A pool of idle connections belonging to one io_service.
+class connection_pool
+  : public boost::enable_shared_from_this<connection_pool>,
+    private boost::noncopyable
+{
+public:
+  /// Construct an empty pool creating connections on the given io_service.
+  connection_pool(boost::asio::io_service& io_service,
+      request_handler& handler, const server_options& options,
+      bool use_strand, server_stats& stats, const timer_wheel_ptr& wheel);
+
+  /// Destroy the pool and the idle connections it holds.
+  ~connection_pool();
+
+  /// Get a connection ready to be accepted into, reusing an idle one when
+  /// available. The connection returns to the pool when the last reference
+  /// to it is dropped.
+  connection_ptr acquire();
+
+  /// Number of idle connections currently held.
+  std::size_t idle_count();
+
+private:
+  /// Reset a connection whose last reference was dropped and keep it for
+  /// reuse, or delete it when the pool is full or no longer exists.
+  static void release(const boost::weak_ptr<connection_pool>& pool, connection* c);
+
+  /// The io_service new connections are created on.
+  boost::asio::io_service& io_service_;
+
+  /// The handler passed to new connections.
+  request_handler& request_handler_;
+
+  /// Server wide configuration.
+  const server_options& options_;
+
+  /// Whether new connections need a strand.
+  bool use_strand_;
+
+  /// Counters for pool hits and misses.
+  server_stats& stats_;
+
+  /// The wheel enforcing deadlines for new connections.
+  timer_wheel_ptr timer_wheel_;
+
+  /// Protects idle_, connections are released from any io thread.
+  boost::mutex mutex_;
+
+  /// Idle connections ready for reuse.
+  std::vector<connection*> idle_;
+};
+
+typedef boost::shared_ptr<connection_pool> connection_pool_ptr;
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_SERVER_CONNECTION_POOL_HPP
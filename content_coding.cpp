@@ -0,0 +1,141 @@
+//
+// content_coding.cpp
+// ~~~~~~~~~~~~~~~~~~
+//
+
+#include "content_coding.hpp"
+#include <cctype>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/trim.hpp>
+#include <boost/noncopyable.hpp>
+#include <zlib.h>
+
+namespace http {
+namespace server {
+namespace content_coding {
+
+namespace {
+
+/// zlib compression state kept for reuse by one thread. Setting up a
+/// deflate stream allocates a few hundred kilobytes, resetting one does not.
+class deflater
+  : private boost::noncopyable
+{
+public:
+  /// Construct for the zlib window bits selecting the wrapper, 15 + 16 for
+  /// gzip and 15 for the zlib format HTTP calls deflate.
+  explicit deflater(int window_bits)
+    : window_bits_(window_bits),
+      level_(0),
+      initialized_(false)
+  {
+  }
+
+  ~deflater()
+  {
+    if (initialized_)
+      ::deflateEnd(&stream_);
+  }
+
+  bool compress(const char* data, std::size_t size, int level, std::string& out)
+  {
+    if (size > UINT_MAX)
+      return false;
+
+    if (initialized_ && level != level_)
+    {
+      ::deflateEnd(&stream_);
+      initialized_ = false;
+    }
+    if (!initialized_)
+    {
+      std::memset(&stream_, 0, sizeof(stream_));
+      if (::deflateInit2(&stream_, level, Z_DEFLATED, window_bits_, 8,
+            Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+      level_ = level;
+      initialized_ = true;
+    }
+    else if (::deflateReset(&stream_) != Z_OK)
+    {
+      return false;
+    }
+
+    out.resize(::deflateBound(&stream_, static_cast<uLong>(size)));
+    stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream_.avail_in = static_cast<uInt>(size);
+    stream_.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    stream_.avail_out = static_cast<uInt>(out.size());
+    if (::deflate(&stream_, Z_FINISH) != Z_STREAM_END)
+      return false;
+    out.resize(stream_.total_out);
+    return true;
+  }
+
+private:
+  z_stream stream_;
+  int window_bits_;
+  int level_;
+  bool initialized_;
+};
+
+} // namespace
+
+double quality(const std::string& accept_encoding, const std::string& coding)
+{
+  double any = 0.0;
+  std::istringstream items(accept_encoding);
+  std::string item;
+  while (std::getline(items, item, ','))
+  {
+    std::size_t semicolon = item.find(';');
+    std::string name = item.substr(0, semicolon);
+    boost::algorithm::trim(name);
+    boost::algorithm::to_lower(name);
+
+    double q = 1.0;
+    if (semicolon != std::string::npos)
+    {
+      std::string parameter = item.substr(semicolon + 1);
+      boost::algorithm::trim(parameter);
+      if (parameter.size() > 2 && std::tolower(parameter[0]) == 'q'
+          && parameter[1] == '=')
+        q = std::strtod(parameter.c_str() + 2, 0);
+    }
+
+    if (name == coding || (coding == "gzip" && name == "x-gzip"))
+      return q;
+    if (name == "*")
+      any = q;
+  }
+  return any;
+}
+
+bool can_compress(const std::string& coding)
+{
+  return coding == "gzip" || coding == "deflate";
+}
+
+bool compress(const std::string& coding, const char* data, std::size_t size,
+    int level, std::string& out)
+{
+  if (coding == "gzip")
+  {
+    static thread_local deflater gzip(15 + 16);
+    return gzip.compress(data, size, level, out);
+  }
+  if (coding == "deflate")
+  {
+    static thread_local deflater deflate(15);
+    return deflate.compress(data, size, level, out);
+  }
+  return false;
+}
+
+} // namespace content_coding
+} // namespace server
+} // namespace http
@@ -0,0 +1,35 @@
+//
+// content_coding.hpp
+// ~~~~~~~~~~~~~~~~~~
+//
+// Negotiation of content codings and compression of reply bodies.
+//
+
+#ifndef HTTP_SERVER_CONTENT_CODING_HPP
+#define HTTP_SERVER_CONTENT_CODING_HPP
+
+#include <cstddef>
+#include <string>
+
+namespace http {
+namespace server {
+namespace content_coding {
+
+/// The quality a client gives a coding in the value of its Accept-Encoding
+/// header, zero when the coding is not acceptable.
+double quality(const std::string& accept_encoding, const std::string& coding);
+
+/// Whether the server can compress with a coding itself, i.e. "gzip" or
+/// "deflate".
+bool can_compress(const std::string& coding);
+
+/// Compress data with a coding the server can produce, reusing the zlib
+/// state of the calling thread. Returns false if compression failed.
+bool compress(const std::string& coding, const char* data, std::size_t size,
+    int level, std::string& out);
+
+} // namespace content_coding
+} // namespace server
+} // namespace http
+
+#endif // HTTP_SERVER_CONTENT_CODING_HPP
@@ -0,0 +1,163 @@
+//
+// coroutine_bench.cpp
+// ~~~~~~~~~~~~~~~~~~~
+//
+// Compares a handler that blocks an io thread while it waits with a
+// coroutine handler that suspends on a timer instead. Both wait the same
+// time per request; the server runs in process and is driven over loopback
+// by keep-alive clients.
+//
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <boost/asio.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/bind.hpp>
+#include <boost/chrono.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+#include "server.hpp"
+
+namespace {
+
+using namespace http::server;
+
+/// How long each handler waits before replying.
+const int wait_ms = 50;
+
+class blocking_handler : public registered_handler
+{
+public:
+  blocking_handler() : registered_handler("/blocking") { ; }
+
+  void handle_request(const request&, reply& rep) const
+  {
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(wait_ms));
+    rep.content = "blocking\n";
+  }
+
+  const char* usage_info() const { return "Sleeps on the io thread"; }
+};
+
+class waiting_handler : public coroutine_handler
+{
+public:
+  waiting_handler() : coroutine_handler("/coroutine") { ; }
+
+  void handle_coroutine(const request&, reply& rep,
+      boost::asio::io_service& io_service,
+      boost::asio::yield_context yield) const
+  {
+    boost::asio::deadline_timer timer(io_service,
+        boost::posix_time::milliseconds(wait_ms));
+    timer.async_wait(yield);
+    rep.content = "coroutine\n";
+  }
+
+  const char* usage_info() const { return "Waits on a timer in a coroutine"; }
+};
+
+/// Send requests one after another on a keep-alive connection, reading each
+/// reply before the next request.
+void run_client(boost::asio::io_service& io_service,
+    const boost::asio::ip::tcp::endpoint& endpoint, const std::string& path,
+    std::size_t requests, std::size_t& failures,
+    boost::asio::yield_context yield)
+{
+  boost::system::error_code ec;
+  boost::asio::ip::tcp::socket socket(io_service);
+  socket.async_connect(endpoint, yield[ec]);
+  std::string request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  boost::asio::streambuf buffer;
+  for (std::size_t i = 0; !ec && i < requests; ++i)
+  {
+    boost::asio::async_write(socket, boost::asio::buffer(request), yield[ec]);
+    if (ec)
+      break;
+    std::size_t head = boost::asio::async_read_until(socket, buffer, "\r\n\r\n", yield[ec]);
+    if (ec)
+      break;
+    std::string headers(boost::asio::buffers_begin(buffer.data()),
+        boost::asio::buffers_begin(buffer.data()) + head);
+    buffer.consume(head);
+    std::size_t length = 0;
+    std::size_t found = headers.find("Content-Length: ");
+    if (found != std::string::npos)
+      length = std::strtoul(headers.c_str() + found + 16, 0, 10);
+    if (buffer.size() < length)
+      boost::asio::async_read(socket, buffer,
+          boost::asio::transfer_exactly(length - buffer.size()), yield[ec]);
+    buffer.consume(length);
+  }
+  if (ec)
+    ++failures;
+}
+
+/// Run the clients against a path and report the request rate.
+void measure(const boost::asio::ip::tcp::endpoint& endpoint,
+    const std::string& path, std::size_t connections, std::size_t requests)
+{
+  boost::asio::io_service io_service;
+  std::size_t failures = 0;
+  for (std::size_t i = 0; i < connections; ++i)
+  {
+    boost::asio::spawn(io_service, boost::bind(&run_client,
+          boost::ref(io_service), endpoint, path, requests,
+          boost::ref(failures), _1));
+  }
+
+  boost::chrono::steady_clock::time_point start = boost::chrono::steady_clock::now();
+  io_service.run();
+  double seconds = boost::chrono::duration<double>(
+      boost::chrono::steady_clock::now() - start).count();
+
+  std::cout << path << ": " << connections << " connections x " << requests
+    << " requests in " << seconds << " s, "
+    << static_cast<std::size_t>(connections * requests / seconds) << " req/s";
+  if (failures)
+    std::cout << ", " << failures << " connections failed";
+  std::cout << "\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  try
+  {
+    if (argc > 3)
+    {
+      std::cerr << "Usage: coroutine_bench [<port> [<threads>]]\n";
+      return 1;
+    }
+    std::string port = argc > 1 ? argv[1] : "8091";
+    std::size_t num_threads = argc > 2
+      ? boost::lexical_cast<std::size_t>(argv[2]) : 2;
+
+    server_options options;
+    options.max_requests_in_flight = 0;
+    server s("127.0.0.1", port, ".", num_threads, options);
+    s.register_handler(std::shared_ptr<registered_handler>(new blocking_handler()));
+    s.register_handler(std::shared_ptr<registered_handler>(new waiting_handler()));
+    boost::thread server_thread(boost::bind(&server::run, &s));
+
+    boost::asio::ip::tcp::endpoint endpoint(
+        boost::asio::ip::address::from_string("127.0.0.1"),
+        boost::lexical_cast<unsigned short>(port));
+    std::cout << num_threads << " io threads, handlers wait " << wait_ms << " ms\n";
+    measure(endpoint, "/blocking", 200, 5);
+    measure(endpoint, "/coroutine", 200, 5);
+    measure(endpoint, "/coroutine", 2000, 5);
+
+    s.stop();
+    server_thread.join();
+  }
+  catch (std::exception& e)
+  {
+    std::cerr << "exception: " << e.what() << "\n";
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,84 @@
+//
+// deferred_reply.cpp
+// ~~~~~~~~~~~~~~~~~~
+//
+
+#include "deferred_reply.hpp"
+#include "reply.hpp"
+#include <utility>
+
+namespace http {
+namespace server {
+
+deferred_reply::deferred_reply(const boost::function<void(reply&)>& finish)
+  : finish_(finish),
+    completed_(false),
+    cancelled_(false)
+{
+}
+
+deferred_reply::~deferred_reply()
+{
+}
+
+void deferred_reply::complete(reply& rep)
+{
+  boost::function<void()> notify;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (completed_ || cancelled_)
+      return;
+    completed_ = true;
+    reply_.reset(new reply());
+    std::swap(*reply_, rep);
+    notify.swap(notify_);
+  }
+
+  if (notify)
+    notify();
+}
+
+bool deferred_reply::cancelled() const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return cancelled_;
+}
+
+bool deferred_reply::take(reply& rep, const boost::function<void()>& notify)
+{
+  boost::scoped_ptr<reply> completed;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (!reply_)
+    {
+      if (notify)
+        notify_ = notify;
+      return false;
+    }
+    completed.swap(reply_);
+  }
+
+  // Called on the connection's thread, so the finishing work is done there
+  // and never under the lock.
+  completed->headers.insert(rep.headers.begin(), rep.headers.end());
+  std::swap(rep, *completed);
+  if (finish_)
+    finish_(rep);
+  return true;
+}
+
+void deferred_reply::cancel()
+{
+  boost::function<void()> notify;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    cancelled_ = true;
+    notify.swap(notify_);
+  }
+
+  // The connection's notify handler is dropped outside the lock, it may hold
+  // the last reference to the connection.
+}
+
+} // namespace server
+} // namespace http
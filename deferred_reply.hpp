@@ -0,0 +1,77 @@
+//
+// deferred_reply.hpp
+// ~~~~~~~~~~~~~~~~~~
+//
+// A reply completed later, from any thread, by an asynchronous handler.
+//
+
+#ifndef HTTP_SERVER_DEFERRED_REPLY_HPP
+#define HTTP_SERVER_DEFERRED_REPLY_HPP
+
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace http {
+namespace server {
+
+struct reply;
+
+/// The reply to a request whose handler completes asynchronously. The
+/// connection keeps its place in the reply queue and waits for it without
+/// holding a thread, replies to later pipelined requests are held back until
+/// it is written.
+class deferred_reply
+  : private boost::noncopyable
+{
+public:
+  /// Construct with the function finishing a completed reply, called on the
+  /// connection's io thread before the reply is written.
+  explicit deferred_reply(const boost::function<void(reply&)>& finish);
+
+  ~deferred_reply();
+
+  /// Deliver the reply, leaving rep empty. Only the first call counts, and
+  /// nothing happens once the connection is gone.
+  void complete(reply& rep);
+
+  /// Whether the connection is gone, so the reply is no longer wanted.
+  bool cancelled() const;
+
+  /// Move the completed reply into rep, keeping the headers already set on
+  /// rep. Returns false if the handler has not completed yet, in which case
+  /// notify is called once it does unless notify is empty. The caller must
+  /// hold a reference to the deferred reply, rep may hold the only other.
+  bool take(reply& rep, const boost::function<void()>& notify);
+
+  /// Give up on the reply because the connection is gone.
+  void cancel();
+
+private:
+  /// Protects everything below.
+  mutable boost::mutex mutex_;
+
+  /// Finishes the completed reply.
+  boost::function<void(reply&)> finish_;
+
+  /// The completed reply, null until complete is called and once taken.
+  boost::scoped_ptr<reply> reply_;
+
+  /// Whether complete has been called.
+  bool completed_;
+
+  /// Whether the connection is gone.
+  bool cancelled_;
+
+  /// Set while the connection waits for the reply, holding the connection.
+  boost::function<void()> notify_;
+};
+
+typedef boost::shared_ptr<deferred_reply> deferred_reply_ptr;
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_SERVER_DEFERRED_REPLY_HPP
@@ -0,0 +1,103 @@
+//
+// file_body.cpp
+// ~~~~~~~~~~~~~
+//
+
+#include "file_body.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace http {
+namespace server {
+
+file_body_ptr file_body::open(const std::string& path)
+{
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return file_body_ptr();
+
+  struct stat status;
+  if (::fstat(fd, &status) != 0 || !S_ISREG(status.st_mode))
+  {
+    ::close(fd);
+    return file_body_ptr();
+  }
+
+  return file_body_ptr(new file_body(fd, status));
+}
+
+file_body_ptr file_body::temporary(const std::string& directory)
+{
+  int fd = ::open(directory.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+  if (fd < 0)
+  {
+    // Not every file system supports O_TMPFILE.
+    std::string path = directory + "/http_body_XXXXXX";
+    fd = ::mkostemp(&path[0], O_CLOEXEC);
+    if (fd < 0)
+      return file_body_ptr();
+    ::unlink(path.c_str());
+  }
+
+  struct stat status;
+  if (::fstat(fd, &status) != 0)
+  {
+    ::close(fd);
+    return file_body_ptr();
+  }
+
+  return file_body_ptr(new file_body(fd, status));
+}
+
+file_body::file_body(int fd, const struct stat& status)
+  : offset(0),
+    length(static_cast<std::size_t>(status.st_size)),
+    fd_(fd),
+    status_(status)
+{
+}
+
+file_body::~file_body()
+{
+  ::close(fd_);
+}
+
+std::string file_body::etag() const
+{
+  char tag[64];
+  std::snprintf(tag, sizeof(tag), "\"%lx-%lx-%lx\"",
+      static_cast<unsigned long>(status_.st_ino),
+      static_cast<unsigned long>(status_.st_mtime),
+      static_cast<unsigned long>(status_.st_size));
+  return tag;
+}
+
+std::string file_body::last_modified() const
+{
+  return http_date(status_.st_mtime);
+}
+
+std::string file_body::http_date(time_t t)
+{
+  struct tm gmt;
+  char date[64];
+  ::gmtime_r(&t, &gmt);
+  std::size_t length = std::strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &gmt);
+  return std::string(date, length);
+}
+
+bool file_body::parse_http_date(const std::string& date, time_t& t)
+{
+  struct tm gmt = tm();
+  const char* end = ::strptime(date.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &gmt);
+  if (end == 0 || *end != '\0')
+    return false;
+  t = ::timegm(&gmt);
+  return true;
+}
+
+} // namespace server
+} // namespace http
@@ -0,0 +1,81 @@
+//
+// file_body.hpp
+// ~~~~~~~~~~~~~
+//
+// A file sent as the body of a reply straight from the page cache with
+// sendfile, rather than being read into reply::content.
+//
+
+#ifndef HTTP_SERVER_FILE_BODY_HPP
+#define HTTP_SERVER_FILE_BODY_HPP
+
+#include <cstddef>
+#include <string>
+#include <sys/stat.h>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+namespace http {
+namespace server {
+
+/// An open regular file and the span of it to send.
+class file_body
+  : private boost::noncopyable
+{
+public:
+  /// Open a regular file for reading. Returns null if the file can not be
+  /// opened or is not a regular file.
+  static boost::shared_ptr<file_body> open(const std::string& path);
+
+  /// Create an empty, already unlinked file for reading and writing in the
+  /// given directory. Returns null if it can not be created.
+  static boost::shared_ptr<file_body> temporary(const std::string& directory);
+
+  /// Close the file.
+  ~file_body();
+
+  /// The descriptor of the open file.
+  int descriptor() const { return fd_; }
+
+  /// The metadata of the file when it was opened.
+  const struct stat& status() const { return status_; }
+
+  /// Size of the whole file.
+  std::size_t size() const { return static_cast<std::size_t>(status_.st_size); }
+
+  /// Strong entity tag for the file, derived from its inode, modification
+  /// time and size.
+  std::string etag() const;
+
+  /// The modification time of the file formatted as an HTTP date.
+  std::string last_modified() const;
+
+  /// Format a time as an HTTP date, e.g. "Sun, 06 Nov 1994 08:49:37 GMT".
+  static std::string http_date(time_t t);
+
+  /// Parse an HTTP date in the preferred format. Returns false if the date
+  /// can not be parsed.
+  static bool parse_http_date(const std::string& date, time_t& t);
+
+  /// Offset of the first byte to send.
+  std::size_t offset;
+
+  /// Number of bytes to send.
+  std::size_t length;
+
+private:
+  file_body(int fd, const struct stat& status);
+
+  /// The open descriptor.
+  int fd_;
+
+  /// The metadata of the file.
+  struct stat status_;
+};
+
+typedef boost::shared_ptr<file_body> file_body_ptr;
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_SERVER_FILE_BODY_HPP
@@ -0,0 +1,445 @@
+//
+// file_cache.cpp
+// ~~~~~~~~~~~~~~
+//
+
+#include "file_cache.hpp"
+#include <cerrno>
+#include <cstring>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <boost/bind.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/lexical_cast.hpp>
+#include "mime_types.hpp"
+
+namespace http {
+namespace server {
+
+namespace {
+
+/// Changes that make cached copies of files in a watched directory stale.
+const uint32_t watch_mask = IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE
+  | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+/// Content codings with a precompressed sibling file, and its suffix.
+struct sibling
+{
+  const char* content_encoding;
+  const char* suffix;
+} siblings[] =
+{
+  { "br", ".br" },
+  { "gzip", ".gz" },
+  { 0, 0 }
+};
+
+/// Every content coding a variant of a file may be cached in.
+const char* const variant_encodings[] = { "br", "gzip", "deflate", 0 };
+
+/// The directory part of a path.
+std::string parent_directory(const std::string& path)
+{
+  std::size_t last_slash_pos = path.find_last_of("/");
+  return last_slash_pos == std::string::npos ? std::string(".") : path.substr(0, last_slash_pos);
+}
+
+/// Whether two stats describe the same version of the same file.
+bool same_version(const struct stat& a, const struct stat& b)
+{
+  return a.st_dev == b.st_dev && a.st_ino == b.st_ino
+    && a.st_size == b.st_size
+    && a.st_mtim.tv_sec == b.st_mtim.tv_sec
+    && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+}
+
+} // namespace
+
+file_cache::file_cache(const server_options& options, server_stats& stats)
+  : options_(options),
+    stats_(stats),
+    inotify_fd_(-1),
+    enabled_(false)
+{
+  for (std::size_t i = 0; i < std::max<std::size_t>(options_.file_cache_shards, 1); ++i)
+    shards_.push_back(boost::shared_ptr<shard>(new shard()));
+}
+
+file_cache::~file_cache()
+{
+  // The stream_descriptor owns and closes the inotify descriptor.
+}
+
+void file_cache::start(boost::asio::io_service& io_service)
+{
+  if (options_.file_cache_bytes == 0 || inotify_)
+    return;
+
+  inotify_fd_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd_ < 0)
+    return;
+
+  inotify_.reset(new boost::asio::posix::stream_descriptor(io_service, inotify_fd_));
+  enabled_ = true;
+  start_read();
+}
+
+bool file_cache::enabled() const
+{
+  return enabled_;
+}
+
+std::string file_cache::key(const std::string& path,
+    const std::string& content_encoding)
+{
+  // Request paths never contain a NUL, so variants can not clash with files.
+  return content_encoding.empty() ? path : path + '\0' + content_encoding;
+}
+
+file_cache::shard& file_cache::shard_for(const std::string& path)
+{
+  std::size_t length = path.find('\0');
+  std::size_t hash = boost::hash_range(path.begin(),
+      length == std::string::npos ? path.end() : path.begin() + length);
+  return *shards_[hash % shards_.size()];
+}
+
+std::string file_cache::sibling_path(const std::string& path,
+    const std::string& content_encoding)
+{
+  for (const sibling* s = siblings; s->content_encoding; ++s)
+  {
+    if (content_encoding == s->content_encoding)
+      return path + s->suffix;
+  }
+  return std::string();
+}
+
+file_cache::entry_ptr file_cache::find(const std::string& path,
+    const std::string& content_encoding)
+{
+  if (!enabled())
+    return entry_ptr();
+
+  std::string k = key(path, content_encoding);
+  shard& s = shard_for(k);
+  boost::mutex::scoped_lock lock(s.mutex);
+  auto found = s.index.find(k);
+  if (found == s.index.end())
+  {
+    ++stats_.file_cache_misses;
+    return entry_ptr();
+  }
+
+  ++stats_.file_cache_hits;
+  s.lru.splice(s.lru.begin(), s.lru, found->second);
+  return *found->second;
+}
+
+file_cache::entry_ptr file_cache::insert(const std::string& path,
+    const file_body& file, const std::string& content_type,
+    const std::string& content_encoding)
+{
+  std::size_t shard_budget = options_.file_cache_bytes / shards_.size();
+  if (!enabled() || file.size() > options_.file_cache_max_file_size
+      || file.size() > shard_budget)
+    return entry_ptr();
+
+  // Watch before reading so a change made while reading is not missed.
+  if (!watch_directory(path))
+    return entry_ptr();
+
+  boost::shared_ptr<std::string> content(new std::string(file.size(), '\0'));
+  std::size_t read = 0;
+  while (read < content->size())
+  {
+    ssize_t n = ::pread(file.descriptor(), &(*content)[read], content->size() - read, read);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return entry_ptr();
+    read += n;
+  }
+
+  // Do not cache a file that changed since it was opened, its tag and
+  // length would not match what was read.
+  struct stat status;
+  if (::fstat(file.descriptor(), &status) != 0
+      || !same_version(status, file.status()))
+    return entry_ptr();
+
+  boost::shared_ptr<entry> e(new entry());
+  e->path = path;
+  e->content_encoding = content_encoding;
+  e->content = content;
+  e->content_type = content_type;
+  e->etag = file.etag();
+  e->last_modified = file.status().st_mtime;
+  e->no_precompressed = false;
+  e->headers.reset(new std::string(make_headers(*e)));
+  return store(e, entry_ptr(), &status);
+}
+
+file_cache::entry_ptr file_cache::insert_variant(const entry_ptr& file,
+    const std::string& content_encoding, const std::string& content)
+{
+  std::size_t shard_budget = options_.file_cache_bytes / shards_.size();
+  if (!enabled() || content.size() > shard_budget)
+    return entry_ptr();
+
+  // The variant is equivalent to the file but not byte for byte the same,
+  // so its tag is weak.
+  boost::shared_ptr<entry> e(new entry());
+  e->path = file->path;
+  e->content_encoding = content_encoding;
+  e->content.reset(new std::string(content));
+  e->content_type = file->content_type;
+  e->etag = file->etag.compare(0, 2, "W/") == 0 ? file->etag : "W/" + file->etag;
+  e->last_modified = file->last_modified;
+  e->no_precompressed = false;
+  e->headers.reset(new std::string(make_headers(*e)));
+  return store(e, file);
+}
+
+std::string file_cache::make_headers(const entry& e)
+{
+  std::string headers;
+  headers += "Content-Type: " + e.content_type + "\r\n";
+  headers += "Content-Length: " + boost::lexical_cast<std::string>(e.content->size()) + "\r\n";
+  if (!e.content_encoding.empty())
+    headers += "Content-Encoding: " + e.content_encoding + "\r\n";
+  if (!e.content_encoding.empty() || mime_types::is_compressible(e.content_type))
+    headers += "Vary: Accept-Encoding\r\n";
+  headers += "Last-Modified: " + file_body::http_date(e.last_modified) + "\r\n";
+  headers += "ETag: " + e.etag + "\r\n";
+  if (e.content_encoding.empty())
+    headers += "Accept-Ranges: bytes\r\n";
+  return headers;
+}
+
+file_cache::entry_ptr file_cache::store(const boost::shared_ptr<entry>& e,
+    const entry_ptr& source, const struct stat* opened)
+{
+  std::size_t shard_budget = options_.file_cache_bytes / shards_.size();
+  std::string k = key(e->path, e->content_encoding);
+  shard& s = shard_for(k);
+  boost::mutex::scoped_lock lock(s.mutex);
+  if (source)
+  {
+    // Shares the shard of the source, so this can be checked under the lock.
+    auto current = s.index.find(key(source->path, source->content_encoding));
+    if (current == s.index.end() || *current->second != source)
+      return entry_ptr();
+  }
+  if (opened)
+  {
+    // The file may have been replaced after it was opened, possibly before
+    // its directory was watched. Invalidations take this lock, so once the
+    // path is found to still name the opened file any later change is seen
+    // by an invalidation that runs after the entry is stored.
+    std::string path = e->content_encoding.empty()
+      ? e->path : sibling_path(e->path, e->content_encoding);
+    struct stat current;
+    if (::stat(path.c_str(), &current) != 0 || !same_version(current, *opened))
+      return entry_ptr();
+
+    // Likewise a sibling created later invalidates the file, so one that is
+    // missing now need not be looked for again while the file is cached.
+    if (e->content_encoding.empty() && options_.serve_precompressed
+        && mime_types::is_compressible(e->content_type))
+    {
+      e->no_precompressed = true;
+      for (const sibling* sib = siblings; sib->content_encoding; ++sib)
+      {
+        if (::stat((e->path + sib->suffix).c_str(), &current) == 0 || errno != ENOENT)
+          e->no_precompressed = false;
+      }
+    }
+  }
+  erase(s, k);
+
+  while (!s.lru.empty() && s.bytes + e->content->size() > shard_budget)
+  {
+    entry_ptr victim = s.lru.back();
+    erase(s, key(victim->path, victim->content_encoding));
+    ++stats_.file_cache_evictions;
+  }
+
+  s.lru.push_front(e);
+  s.index[k] = s.lru.begin();
+  s.bytes += e->content->size();
+  return e;
+}
+
+bool file_cache::erase(shard& s, const std::string& key)
+{
+  auto found = s.index.find(key);
+  if (found == s.index.end())
+    return false;
+  s.bytes -= (*found->second)->content->size();
+  s.lru.erase(found->second);
+  s.index.erase(found);
+  return true;
+}
+
+std::size_t file_cache::size() const
+{
+  std::size_t bytes = 0;
+  for (const boost::shared_ptr<shard>& s : shards_)
+  {
+    boost::mutex::scoped_lock lock(s->mutex);
+    bytes += s->bytes;
+  }
+  return bytes;
+}
+
+void file_cache::invalidate(const std::string& path)
+{
+  // A change to a precompressed sibling invalidates that variant of the
+  // file, and the file itself if it was cached as having no siblings. A
+  // change to the file invalidates every variant of it.
+  for (const sibling* sib = siblings; sib->content_encoding; ++sib)
+  {
+    std::size_t suffix = std::strlen(sib->suffix);
+    if (path.size() > suffix
+        && path.compare(path.size() - suffix, suffix, sib->suffix) == 0)
+    {
+      std::string file = path.substr(0, path.size() - suffix);
+      shard& s = shard_for(file);
+      boost::mutex::scoped_lock lock(s.mutex);
+      if (erase(s, key(file, sib->content_encoding)))
+        ++stats_.file_cache_invalidations;
+      auto found = s.index.find(file);
+      if (found != s.index.end() && (*found->second)->no_precompressed
+          && erase(s, file))
+        ++stats_.file_cache_invalidations;
+    }
+  }
+
+  shard& s = shard_for(path);
+  boost::mutex::scoped_lock lock(s.mutex);
+  if (erase(s, path))
+    ++stats_.file_cache_invalidations;
+  for (const char* const* coding = variant_encodings; *coding; ++coding)
+  {
+    if (erase(s, key(path, *coding)))
+      ++stats_.file_cache_invalidations;
+  }
+}
+
+void file_cache::invalidate_directory(const std::string& directory)
+{
+  std::string prefix = directory + "/";
+  for (const boost::shared_ptr<shard>& s : shards_)
+  {
+    boost::mutex::scoped_lock lock(s->mutex);
+    for (auto i = s->lru.begin(); i != s->lru.end();)
+    {
+      const entry& e = **i++;
+      if (e.path.compare(0, prefix.size(), prefix) == 0)
+      {
+        erase(*s, key(e.path, e.content_encoding));
+        ++stats_.file_cache_invalidations;
+      }
+    }
+  }
+}
+
+void file_cache::clear()
+{
+  for (const boost::shared_ptr<shard>& s : shards_)
+  {
+    boost::mutex::scoped_lock lock(s->mutex);
+    stats_.file_cache_invalidations += s->index.size();
+    s->lru.clear();
+    s->index.clear();
+    s->bytes = 0;
+  }
+}
+
+bool file_cache::watch_directory(const std::string& path)
+{
+  std::string directory = parent_directory(path);
+  boost::mutex::scoped_lock lock(watch_mutex_);
+  if (watched_directories_.find(directory) != watched_directories_.end())
+    return true;
+
+  int wd = ::inotify_add_watch(inotify_fd_, directory.c_str(), watch_mask);
+  if (wd < 0)
+    return false;
+
+  watches_[wd] = directory;
+  watched_directories_[directory] = wd;
+  return true;
+}
+
+void file_cache::start_read()
+{
+  inotify_->async_read_some(boost::asio::buffer(event_buffer_),
+      boost::bind(&file_cache::handle_read, this,
+        boost::asio::placeholders::error,
+        boost::asio::placeholders::bytes_transferred));
+}
+
+void file_cache::handle_read(const boost::system::error_code& e,
+    std::size_t bytes_transferred)
+{
+  if (e)
+  {
+    // Without events nothing can be trusted to be current any more.
+    if (e != boost::asio::error::operation_aborted)
+    {
+      enabled_ = false;
+      clear();
+    }
+    return;
+  }
+
+  std::size_t offset = 0;
+  while (offset + sizeof(inotify_event) <= bytes_transferred)
+  {
+    const inotify_event* event = reinterpret_cast<const inotify_event*>(event_buffer_.data() + offset);
+    offset += sizeof(inotify_event) + event->len;
+
+    if (event->mask & IN_Q_OVERFLOW)
+    {
+      clear();
+      continue;
+    }
+
+    std::string directory;
+    {
+      boost::mutex::scoped_lock lock(watch_mutex_);
+      auto watch = watches_.find(event->wd);
+      if (watch == watches_.end())
+        continue;
+      directory = watch->second;
+      if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+      {
+        // The directory is gone from where it was watched, it is watched
+        // again under its new path should files there be cached.
+        if (!(event->mask & IN_IGNORED))
+          ::inotify_rm_watch(inotify_fd_, event->wd);
+        watched_directories_.erase(directory);
+        watches_.erase(watch);
+      }
+    }
+
+    if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+    {
+      invalidate_directory(directory);
+    }
+    else if (event->len != 0)
+    {
+      std::string path = directory + "/" + event->name;
+      invalidate(path);
+      if (event->mask & IN_ISDIR)
+        invalidate_directory(path);
+    }
+  }
+
+  start_read();
+}
+
+} // namespace server
+} // namespace http
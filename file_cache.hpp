@@ -0,0 +1,204 @@
+//
+// file_cache.hpp
+// ~~~~~~~~~~~~~~
+//
+// Bounded cache of small static files together with their serialized
+// response headers. Entries are dropped as soon as inotify reports a change
+// under the document root.
+//
+
+#ifndef HTTP_SERVER_FILE_CACHE_HPP
+#define HTTP_SERVER_FILE_CACHE_HPP
+
+#include <atomic>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/array.hpp>
+#include <boost/asio.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+#include "file_body.hpp"
+#include "server_options.hpp"
+#include "server_stats.hpp"
+
+namespace http {
+namespace server {
+
+/// A sharded LRU cache of file contents keyed by full path and content
+/// coding. A file may be cached as it is and in compressed variants, read
+/// from a precompressed sibling such as foo.js.gz or compressed on demand.
+class file_cache
+  : private boost::noncopyable
+{
+public:
+  /// A cached file. Everything in it is immutable once built and shared by
+  /// every reply sending it.
+  struct entry
+  {
+    /// Full path of the file, without the suffix of a precompressed sibling.
+    std::string path;
+
+    /// Content coding of the cached content, empty when it is the file as it
+    /// is.
+    std::string content_encoding;
+
+    /// Header lines for the file, each ending in CRLF.
+    boost::shared_ptr<const std::string> headers;
+
+    /// The file contents.
+    boost::shared_ptr<const std::string> content;
+
+    /// Media type of the file.
+    std::string content_type;
+
+    /// Entity tag of the file when it was read.
+    std::string etag;
+
+    /// Modification time of the file when it was read.
+    time_t last_modified;
+
+    /// Whether the file was found to have no precompressed sibling when it
+    /// was cached. Creating one invalidates the entry.
+    bool no_precompressed;
+  };
+
+  typedef boost::shared_ptr<const entry> entry_ptr;
+
+  file_cache(const server_options& options, server_stats& stats);
+
+  ~file_cache();
+
+  /// Start watching for changes, reading inotify events on the given
+  /// io_service. The cache stays disabled if inotify is unavailable.
+  void start(boost::asio::io_service& io_service);
+
+  /// Whether files may be cached.
+  bool enabled() const;
+
+  /// Find a cached file, or a variant of it in the given content coding.
+  entry_ptr find(const std::string& path,
+      const std::string& content_encoding = std::string());
+
+  /// Read an opened file into the cache if it is small enough. The content
+  /// type is used to build the cached headers. A content coding means the
+  /// file is the precompressed sibling of path in that coding. Returns null
+  /// when the file is not cached.
+  entry_ptr insert(const std::string& path, const file_body& file,
+      const std::string& content_type,
+      const std::string& content_encoding = std::string());
+
+  /// Cache a compressed variant of a cached file. Returns null when the file
+  /// changed in the meantime or the variant is not cached.
+  entry_ptr insert_variant(const entry_ptr& file,
+      const std::string& content_encoding, const std::string& content);
+
+  /// The path of the precompressed sibling of a file in a content coding,
+  /// empty if the coding has none.
+  static std::string sibling_path(const std::string& path,
+      const std::string& content_encoding);
+
+  /// Number of bytes of file content currently cached.
+  std::size_t size() const;
+
+private:
+  /// One independently locked part of the cache.
+  struct shard
+  {
+    shard() : bytes(0) { ; }
+
+    typedef std::list<entry_ptr> lru_list;
+
+    boost::mutex mutex;
+
+    /// Most recently used first.
+    lru_list lru;
+
+    /// Position of every entry in lru.
+    boost::unordered_map<std::string, lru_list::iterator> index;
+
+    /// Bytes of content held by the shard.
+    std::size_t bytes;
+  };
+
+  /// The index key of a file in a content coding. Variants of a file share
+  /// the shard of the file.
+  static std::string key(const std::string& path,
+      const std::string& content_encoding);
+
+  /// The shard responsible for a path, whatever its content coding.
+  shard& shard_for(const std::string& path);
+
+  /// Build the header lines of an entry.
+  static std::string make_headers(const entry& e);
+
+  /// Add an entry to its shard, evicting others to stay within budget. When
+  /// a source entry is given the entry is only added while the source is
+  /// still cached. When the status of the opened file is given the entry is
+  /// only added while its path still names that version of the file.
+  /// Returns the entry or null if it was not added.
+  entry_ptr store(const boost::shared_ptr<entry>& e, const entry_ptr& source,
+      const struct stat* opened = 0);
+
+  /// Remove the entry for a key from a locked shard. Returns whether there
+  /// was one.
+  bool erase(shard& s, const std::string& key);
+
+  /// Remove a path from the cache.
+  void invalidate(const std::string& path);
+
+  /// Remove every path under a directory from the cache.
+  void invalidate_directory(const std::string& directory);
+
+  /// Remove everything from the cache.
+  void clear();
+
+  /// Make sure the directory holding a path is watched.
+  bool watch_directory(const std::string& path);
+
+  /// Read the next batch of inotify events.
+  void start_read();
+
+  /// Handle a batch of inotify events.
+  void handle_read(const boost::system::error_code& e,
+      std::size_t bytes_transferred);
+
+  /// Server wide configuration.
+  const server_options& options_;
+
+  /// Counters for hits, misses, evictions and invalidations.
+  server_stats& stats_;
+
+  /// The shards of the cache.
+  std::vector<boost::shared_ptr<shard> > shards_;
+
+  /// The inotify instance, -1 when not started.
+  int inotify_fd_;
+
+  /// Whether inotify is delivering events, so cached files can be trusted.
+  std::atomic<bool> enabled_;
+
+  /// Reads events from inotify_fd_.
+  boost::scoped_ptr<boost::asio::posix::stream_descriptor> inotify_;
+
+  /// Buffer for inotify events.
+  boost::array<char, 8192> event_buffer_;
+
+  /// Protects the watch maps, files are cached from any io thread.
+  boost::mutex watch_mutex_;
+
+  /// Watched directory for each watch descriptor.
+  std::map<int, std::string> watches_;
+
+  /// Watch descriptor for each watched directory.
+  std::map<std::string, int> watched_directories_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_SERVER_FILE_CACHE_HPP
@@ -0,0 +1,159 @@
+//
+// handler_allocator.hpp
+// ~~~~~~~~~~~~~~~~~~~~~
+//
+// Per-connection memory for asio completion handlers, based on the boost asio
+// allocation example. Operations started by a connection reuse a small slab
+// of blocks instead of going to the heap on every read and write.
+//
+
+#ifndef HTTP_SERVER_HANDLER_ALLOCATOR_HPP
+#define HTTP_SERVER_HANDLER_ALLOCATOR_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <boost/aligned_storage.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/asio/handler_alloc_hook.hpp>
+#include <boost/asio/handler_invoke_hook.hpp>
+#include <boost/asio/handler_continuation_hook.hpp>
+#include "server_stats.hpp"
+
+namespace http {
+namespace server {
+
+/// Slab of handler memory owned by one connection. Falls back to the heap
+/// when a request is too large or every block is in use.
+class handler_allocator
+  : private boost::noncopyable
+{
+public:
+  explicit handler_allocator(server_stats& stats)
+    : stats_(stats)
+  {
+    for (std::size_t i = 0; i < block_count; ++i)
+      in_use_[i] = false;
+  }
+
+  void* allocate(std::size_t size)
+  {
+    ++stats_.handler_allocations;
+    if (size <= block_size)
+    {
+      for (std::size_t i = 0; i < block_count; ++i)
+      {
+        bool expected = false;
+        if (in_use_[i].compare_exchange_strong(expected, true))
+          return storage_[i].address();
+      }
+    }
+
+    ++stats_.handler_heap_allocations;
+    return ::operator new(size);
+  }
+
+  void deallocate(void* pointer)
+  {
+    for (std::size_t i = 0; i < block_count; ++i)
+    {
+      if (pointer == storage_[i].address())
+      {
+        in_use_[i] = false;
+        return;
+      }
+    }
+
+    ::operator delete(pointer);
+  }
+
+private:
+  /// Enough blocks for a read or write operation plus the strand dispatch
+  /// that follows its completion.
+  enum { block_count = 2, block_size = 512 };
+
+  /// Counters proving the slab is used.
+  server_stats& stats_;
+
+  /// Storage for the blocks.
+  boost::aligned_storage<block_size> storage_[block_count];
+
+  /// Whether each block is currently handed out.
+  std::atomic<bool> in_use_[block_count];
+};
+
+/// Wrapper for a completion handler that routes asio's memory allocation
+/// for the handler through a handler_allocator.
+template <typename Handler>
+class custom_alloc_handler
+{
+public:
+  custom_alloc_handler(handler_allocator& a, Handler h)
+    : allocator_(a),
+      handler_(h)
+  {
+  }
+
+  template <typename Arg1>
+  void operator()(Arg1 arg1)
+  {
+    handler_(arg1);
+  }
+
+  template <typename Arg1, typename Arg2>
+  void operator()(Arg1 arg1, Arg2 arg2)
+  {
+    handler_(arg1, arg2);
+  }
+
+  friend void* asio_handler_allocate(std::size_t size,
+      custom_alloc_handler<Handler>* this_handler)
+  {
+    return this_handler->allocator_.allocate(size);
+  }
+
+  friend void asio_handler_deallocate(void* pointer, std::size_t /*size*/,
+      custom_alloc_handler<Handler>* this_handler)
+  {
+    this_handler->allocator_.deallocate(pointer);
+  }
+
+  template <typename Function>
+  friend void asio_handler_invoke(Function& function,
+      custom_alloc_handler<Handler>* this_handler)
+  {
+    using boost::asio::asio_handler_invoke;
+    asio_handler_invoke(function, &this_handler->handler_);
+  }
+
+  template <typename Function>
+  friend void asio_handler_invoke(const Function& function,
+      custom_alloc_handler<Handler>* this_handler)
+  {
+    using boost::asio::asio_handler_invoke;
+    asio_handler_invoke(function, &this_handler->handler_);
+  }
+
+  friend bool asio_handler_is_continuation(
+      custom_alloc_handler<Handler>* this_handler)
+  {
+    using boost::asio::asio_handler_is_continuation;
+    return asio_handler_is_continuation(&this_handler->handler_);
+  }
+
+private:
+  handler_allocator& allocator_;
+  Handler handler_;
+};
+
+/// Helper function to wrap a handler object to add custom allocation.
+template <typename Handler>
+inline custom_alloc_handler<Handler> make_custom_alloc_handler(
+    handler_allocator& a, Handler h)
+{
+  return custom_alloc_handler<Handler>(a, h);
+}
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_SERVER_HANDLER_ALLOCATOR_HPP
@@ -0,0 +1,93 @@
+//
+// header_id.cpp
+// ~~~~~~~~~~~~~
+//
+
+#include "header_id.hpp"
+
+namespace http {
+namespace server {
+
+namespace {
+
+struct known_name
+{
+  const char* name;
+  header_id id;
+};
+
+/// The well-known names by slot. A name's slot is its length less its
+/// first letter, modulo 32, which happens to differ for every name here.
+/// Adding a name means checking it lands in an empty slot.
+const known_name slots[32] =
+{
+  { 0, unknown_header },                             // 0
+  { "Expect", expect_header },                       // 1
+  { 0, unknown_header },                             // 2
+  { "Cookie", cookie_header },                       // 3
+  { "If-None-Match", if_none_match_header },         // 4
+  { "Accept", accept_header },                       // 5
+  { 0, unknown_header },                             // 6
+  { "Connection", connection_header },               // 7
+  { "If-Modified-Since", if_modified_since_header }, // 8
+  { "Content-Type", content_type_header },           // 9
+  { 0, unknown_header },                             // 10
+  { "Content-Length", content_length_header },       // 11
+  { "Authorization", authorization_header },         // 12
+  { 0, unknown_header },                             // 13
+  { "Accept-Encoding", accept_encoding_header },     // 14
+  { 0, unknown_header },                             // 15
+  { 0, unknown_header },                             // 16
+  { 0, unknown_header },                             // 17
+  { "Upgrade", upgrade_header },                     // 18
+  { "Range", range_header },                         // 19
+  { 0, unknown_header },                             // 20
+  { "User-Agent", user_agent_header },               // 21
+  { 0, unknown_header },                             // 22
+  { 0, unknown_header },                             // 23
+  { 0, unknown_header },                             // 24
+  { 0, unknown_header },                             // 25
+  { 0, unknown_header },                             // 26
+  { 0, unknown_header },                             // 27
+  { "Host", host_header },                           // 28
+  { "Transfer-Encoding", transfer_encoding_header }, // 29
+  { 0, unknown_header },                             // 30
+  { "If-Range", if_range_header }                    // 31
+};
+
+/// The slot the name would be in if it was well known.
+std::size_t slot(boost::string_ref name)
+{
+  return (name.size() - (static_cast<unsigned char>(name[0]) | 0x20)) & 31;
+}
+
+/// A byte as lower case, if it is an ASCII letter.
+char to_lower(char c)
+{
+  return c >= 'A' && c <= 'Z' ? c | 0x20 : c;
+}
+
+} // namespace
+
+header_id identify_header(boost::string_ref name)
+{
+  if (name.empty())
+    return unknown_header;
+  const known_name& known = slots[slot(name)];
+  if (known.name && header_name_equals(name, known.name))
+    return known.id;
+  return unknown_header;
+}
+
+bool header_name_equals(boost::string_ref a, boost::string_ref b)
+{
+  if (a.size() != b.size())
+    return false;
+  for (std::size_t i = 0; i < a.size(); ++i)
+    if (to_lower(a[i]) != to_lower(b[i]))
+      return false;
+  return true;
+}
+
+} // namespace server
+} // namespace http
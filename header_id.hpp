@@ -0,0 +1,49 @@
+//
+// header_id.hpp
+// ~~~~~~~~~~~~~
+//
+// Well-known request header names, recognised once as a request is parsed.
+//
+
+#ifndef HTTP_SERVER_HEADER_ID_HPP
+#define HTTP_SERVER_HEADER_ID_HPP
+
+#include <boost/utility/string_ref.hpp>
+
+namespace http {
+namespace server {
+
+/// Request headers looked up often enough to be found by id rather than by
+/// comparing names.
+enum header_id
+{
+  unknown_header,
+  accept_header,
+  accept_encoding_header,
+  authorization_header,
+  connection_header,
+  content_length_header,
+  content_type_header,
+  cookie_header,
+  expect_header,
+  host_header,
+  if_modified_since_header,
+  if_none_match_header,
+  if_range_header,
+  range_header,
+  transfer_encoding_header,
+  upgrade_header,
+  user_agent_header,
+  header_id_count
+};
+
+/// The id of a header name, ignoring case, or unknown_header.
+header_id identify_header(boost::string_ref name);
+
+/// Whether two header names are equal, ignoring case.
+bool header_name_equals(boost::string_ref a, boost::string_ref b);
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_SERVER_HEADER_ID_HPP
@@ -28,6 +28,20 @@ std::string extension_to_type(const std::string& extension)
   return "text/plain";
 }
 
+bool is_compressible(const std::string& mime_type)
+{
+  std::string type = mime_type.substr(0, mime_type.find(';'));
+  std::size_t plus = type.rfind('+');
+  std::string suffix = plus == std::string::npos ? std::string() : type.substr(plus);
+  return type.compare(0, 5, "text/") == 0
+    || suffix == "+xml"
+    || suffix == "+json"
+    || type == "application/javascript"
+    || type == "application/x-javascript"
+    || type == "application/json"
+    || type == "application/xml";
+}
+
 } // namespace mime_types
 } // namespace server
 } // namespace http
@@ -0,0 +1,105 @@
+//
+// read_buffer.cpp
+// ~~~~~~~~~~~~~~~
+//
+
+#include "read_buffer.hpp"
+#include <cstring>
+#include <vector>
+
+namespace http {
+namespace server {
+
+namespace {
+
+/// Most slabs a thread keeps free, the rest go back to the allocator.
+const std::size_t max_pooled_slabs = 256;
+
+/// The free slabs of one thread. A slab may be given back on another
+/// thread than the one it was taken on, it then joins that thread's list.
+class slab_list
+{
+public:
+  slab_list()
+  {
+    slabs.reserve(max_pooled_slabs);
+  }
+
+  ~slab_list()
+  {
+    for (std::size_t i = 0; i < slabs.size(); ++i)
+      delete[] slabs[i];
+  }
+
+  std::vector<char*> slabs;
+};
+
+thread_local slab_list free_slabs;
+
+} // namespace
+
+const std::size_t read_buffer::slab_size;
+
+read_buffer::read_buffer(std::atomic<std::size_t>& gauge)
+  : gauge_(gauge),
+    data_(0),
+    size_(0)
+{
+}
+
+read_buffer::~read_buffer()
+{
+  release();
+}
+
+void read_buffer::acquire()
+{
+  if (data_)
+    return;
+  data_ = allocate(slab_size);
+  size_ = slab_size;
+  gauge_ += size_;
+}
+
+void read_buffer::resize(std::size_t new_size, std::size_t used)
+{
+  char* data = allocate(new_size);
+  if (used != 0)
+    std::memcpy(data, data_, used);
+  release();
+  data_ = data;
+  size_ = new_size;
+  gauge_ += size_;
+}
+
+void read_buffer::release()
+{
+  if (!data_)
+    return;
+  deallocate(data_, size_);
+  gauge_ -= size_;
+  data_ = 0;
+  size_ = 0;
+}
+
+char* read_buffer::allocate(std::size_t size)
+{
+  if (size == slab_size && !free_slabs.slabs.empty())
+  {
+    char* slab = free_slabs.slabs.back();
+    free_slabs.slabs.pop_back();
+    return slab;
+  }
+  return new char[size];
+}
+
+void read_buffer::deallocate(char* data, std::size_t size)
+{
+  if (size == slab_size && free_slabs.slabs.size() < max_pooled_slabs)
+    free_slabs.slabs.push_back(data);
+  else
+    delete[] data;
+}
+
+} // namespace server
+} // namespace http
@@ -0,0 +1,70 @@
+//
+// read_buffer.hpp
+// ~~~~~~~~~~~~~~~
+//
+// A connection's buffer for incoming data, made of pooled slabs.
+//
+
+#ifndef HTTP_SERVER_READ_BUFFER_HPP
+#define HTTP_SERVER_READ_BUFFER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <boost/noncopyable.hpp>
+
+namespace http {
+namespace server {
+
+/// Memory a connection reads into. It is a slab taken from a free list kept
+/// by each thread, so taking and giving back memory needs neither a lock nor
+/// the allocator, and becomes a larger block of its own only for a request
+/// head too large for a slab.
+class read_buffer
+  : private boost::noncopyable
+{
+public:
+  /// Size of the slabs a buffer starts as.
+  static const std::size_t slab_size = 8192;
+
+  /// Construct holding no memory, counting the bytes held in gauge.
+  explicit read_buffer(std::atomic<std::size_t>& gauge);
+
+  /// Give back the memory held.
+  ~read_buffer();
+
+  /// The memory held, null if there is none.
+  char* data() { return data_; }
+
+  /// Bytes of memory held.
+  std::size_t size() const { return size_; }
+
+  /// Take a slab if no memory is held.
+  void acquire();
+
+  /// Replace the memory with new_size bytes, keeping the first used bytes.
+  void resize(std::size_t new_size, std::size_t used);
+
+  /// Give back the memory held, a slab to the calling thread's free list.
+  void release();
+
+private:
+  /// Memory of the given size, a slab if it is slab_size.
+  static char* allocate(std::size_t size);
+
+  /// Give back memory from allocate.
+  static void deallocate(char* data, std::size_t size);
+
+  /// Counts the bytes held by every buffer.
+  std::atomic<std::size_t>& gauge_;
+
+  /// The memory held.
+  char* data_;
+
+  /// Bytes of memory held.
+  std::size_t size_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_SERVER_READ_BUFFER_HPP
@@ -12,7 +12,10 @@
 #include "reply.hpp"
 #include "request_handler.hpp"
 #include "mime_types.hpp"
+#include "deferred_reply.hpp"
+#include "reply_stream.hpp"
 
+#include <boost/asio/spawn.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/format.hpp>
 #include <memory>
@@ -22,6 +25,21 @@
 namespace http {
 namespace server {
 
+/**
+ * Validators identifying the current version of a resource, see
+ * registered_handler::get_validators
+ */
+struct validators
+{
+  /// Entity tag including its quotes, empty if the resource has none
+  std::string etag;
+
+  /// Modification time of the resource, zero if it has none
+  time_t last_modified;
+
+  validators() : last_modified(0) { ; }
+};
+
 class registered_handler
 {
 public:
@@ -52,11 +70,73 @@ public:
   {
   }
 
+  /**
+   * Where handle_request runs
+   */
+  enum execution_policy
+  {
+    /// On the io thread that read the request
+    execute_inline,
+
+    /// On the server's worker pool, keeping the io threads free
+    execute_on_worker
+  };
+
+  /**
+   * Choose where handle_request runs, the default runs it inline.  Handlers
+   * run on a worker get a copy of the request and their reply is posted back
+   * to the connection.
+   */
+  virtual execution_policy get_execution_policy() const
+  {
+    return execute_inline;
+  }
+
   /**
    * Process the request, required to be implemented by concrete class
    */
   virtual void handle_request(const request& req, reply& rep) const = 0;
 
+  /**
+   * Ask for request bodies to be streamed.  The handler is then called as
+   * soon as the headers have arrived, with req.body set and req.post empty,
+   * and consumes the body through req.body as it is read from the client.
+   * req.body is null for a request without a body.  A handler whose reply is
+   * complete when it returns and that set no data handler has the body read
+   * and dropped, one with a deferred reply not wanting the body after all
+   * still has to discard it.  The default returns false, collecting the body
+   * in req.post before the handler is called.
+   */
+  virtual bool streams_request_body() const
+  {
+    return false;
+  }
+
+  /**
+   * Ask for request bodies larger than the server's body_spill_threshold, or
+   * arriving while its body memory is taken, in req.post_file rather than
+   * req.post.  req.post_file is an unlinked temporary file holding the
+   * body.  Form bodies always stay in req.post.  The default returns false,
+   * bodies are then only ever held in req.post.
+   */
+  virtual bool spills_request_body() const
+  {
+    return false;
+  }
+
+  /**
+   * Optionally describe the current version of the requested resource without
+   * building its body.  When this returns true conditional requests
+   * (If-None-Match, If-Modified-Since) are answered with 304 Not Modified and
+   * handle_request is not called, otherwise the validators are added to the
+   * reply handle_request produces.
+   * @return True if validators were filled in, the default returns false
+   */
+  virtual bool get_validators(const request&, validators&) const
+  {
+    return false;
+  }
+
   const std::string& get_parameter_spec() {
     return parameter_spec;
   }
@@ -114,6 +194,97 @@ private:
   std::set<std::string> parameters_required;
 };
 
+/**
+ * A handler producing its reply body a piece at a time, sent to the client
+ * while it is being produced instead of being built in reply::content first.
+ */
+class streaming_handler : public registered_handler
+{
+public:
+
+  streaming_handler(const std::string& web_service_port, const std::set<std::string>&& parameters_required = {}) :
+      registered_handler(web_service_port, std::move(parameters_required))
+  {
+  }
+
+  /**
+   * Start the reply.  The status and headers are set on rep before returning,
+   * the body is written to the stream now or later, from any thread, and the
+   * stream finished.  A write returning false asks the handler to hold back
+   * until the stream's drain handler is called.
+   */
+  virtual void handle_stream(const request& req, reply& rep, const reply_stream_ptr& stream) const = 0;
+
+  /**
+   * Not used, streaming handlers are always given a stream
+   */
+  virtual void handle_request(const request&, reply&) const
+  {
+  }
+};
+
+/**
+ * A handler completing its reply later, typically once a backend answers,
+ * without holding an io thread meanwhile.
+ */
+class async_handler : public registered_handler
+{
+public:
+
+  async_handler(const std::string& web_service_port, const std::set<std::string>&& parameters_required = {}) :
+      registered_handler(web_service_port, std::move(parameters_required))
+  {
+  }
+
+  /**
+   * Start handling the request and return.  The request is only valid until
+   * then, anything needed later has to be copied.  The reply is delivered by
+   * calling complete on the deferred reply exactly once, from any thread.
+   */
+  virtual void handle_async(const request& req, const deferred_reply_ptr& rep) const = 0;
+
+  /**
+   * Not used, asynchronous handlers always complete through a deferred reply
+   */
+  virtual void handle_request(const request&, reply&) const
+  {
+  }
+};
+
+/**
+ * A handler written as straight-line code that suspends on asynchronous
+ * operations instead of blocking, so a few io threads can keep many slow
+ * requests in flight.
+ */
+class coroutine_handler : public registered_handler
+{
+public:
+
+  coroutine_handler(const std::string& web_service_port, const std::set<std::string>&& parameters_required = {}) :
+      registered_handler(web_service_port, std::move(parameters_required))
+  {
+  }
+
+  /**
+   * Produce the reply, running as a coroutine on the connection's io_service.
+   * Asynchronous operations on objects of that io_service (timers, sockets to
+   * backends) are started with yield as their handler, suspending the
+   * coroutine until they complete, e.g. timer.async_wait(yield).  Blocking
+   * calls hold up every connection of the io thread.  The request is a copy
+   * valid until this returns, the reply is sent once it does.  An exception
+   * escaping the handler is answered with 500 Internal Server Error.
+   */
+  virtual void handle_coroutine(const request& req, reply& rep,
+      boost::asio::io_service& io_service, boost::asio::yield_context yield) const = 0;
+
+  /**
+   * Not used, coroutine handlers always run as a coroutine
+   */
+  virtual void handle_request(const request&, reply&) const
+  {
+  }
+};
+
 } // namespace server
 } // namespace http
 #endif	/* REGISTERED_HANDLER_H */
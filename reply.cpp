@@ -19,37 +19,45 @@ namespace server {
 namespace status_strings {
 
 const std::string ok =
-  "HTTP/1.0 200 OK\r\n";
+  "HTTP/1.1 200 OK\r\n";
 const std::string created =
-  "HTTP/1.0 201 Created\r\n";
+  "HTTP/1.1 201 Created\r\n";
 const std::string accepted =
-  "HTTP/1.0 202 Accepted\r\n";
+  "HTTP/1.1 202 Accepted\r\n";
 const std::string no_content =
-  "HTTP/1.0 204 No Content\r\n";
+  "HTTP/1.1 204 No Content\r\n";
+const std::string partial_content =
+  "HTTP/1.1 206 Partial Content\r\n";
 const std::string multiple_choices =
-  "HTTP/1.0 300 Multiple Choices\r\n";
+  "HTTP/1.1 300 Multiple Choices\r\n";
 const std::string moved_permanently =
-  "HTTP/1.0 301 Moved Permanently\r\n";
+  "HTTP/1.1 301 Moved Permanently\r\n";
 const std::string moved_temporarily =
-  "HTTP/1.0 302 Moved Temporarily\r\n";
+  "HTTP/1.1 302 Moved Temporarily\r\n";
 const std::string not_modified =
-  "HTTP/1.0 304 Not Modified\r\n";
+  "HTTP/1.1 304 Not Modified\r\n";
 const std::string bad_request =
-  "HTTP/1.0 400 Bad Request\r\n";
+  "HTTP/1.1 400 Bad Request\r\n";
 const std::string unauthorized =
-  "HTTP/1.0 401 Unauthorized\r\n";
+  "HTTP/1.1 401 Unauthorized\r\n";
 const std::string forbidden =
-  "HTTP/1.0 403 Forbidden\r\n";
+  "HTTP/1.1 403 Forbidden\r\n";
 const std::string not_found =
-  "HTTP/1.0 404 Not Found\r\n";
+  "HTTP/1.1 404 Not Found\r\n";
+const std::string payload_too_large =
+  "HTTP/1.1 413 Payload Too Large\r\n";
+const std::string range_not_satisfiable =
+  "HTTP/1.1 416 Range Not Satisfiable\r\n";
+const std::string request_header_fields_too_large =
+  "HTTP/1.1 431 Request Header Fields Too Large\r\n";
 const std::string internal_server_error =
-  "HTTP/1.0 500 Internal Server Error\r\n";
+  "HTTP/1.1 500 Internal Server Error\r\n";
 const std::string not_implemented =
-  "HTTP/1.0 501 Not Implemented\r\n";
+  "HTTP/1.1 501 Not Implemented\r\n";
 const std::string bad_gateway =
-  "HTTP/1.0 502 Bad Gateway\r\n";
+  "HTTP/1.1 502 Bad Gateway\r\n";
 const std::string service_unavailable =
-  "HTTP/1.0 503 Service Unavailable\r\n";
+  "HTTP/1.1 503 Service Unavailable\r\n";
 
 boost::asio::const_buffer to_buffer(reply::status_type status)
 {
@@ -63,6 +71,8 @@ boost::asio::const_buffer to_buffer(reply::status_type status)
     return boost::asio::buffer(accepted);
   case reply::no_content:
     return boost::asio::buffer(no_content);
+  case reply::partial_content:
+    return boost::asio::buffer(partial_content);
   case reply::multiple_choices:
     return boost::asio::buffer(multiple_choices);
   case reply::moved_permanently:
@@ -79,6 +89,12 @@ boost::asio::const_buffer to_buffer(reply::status_type status)
     return boost::asio::buffer(forbidden);
   case reply::not_found:
     return boost::asio::buffer(not_found);
+  case reply::payload_too_large:
+    return boost::asio::buffer(payload_too_large);
+  case reply::range_not_satisfiable:
+    return boost::asio::buffer(range_not_satisfiable);
+  case reply::request_header_fields_too_large:
+    return boost::asio::buffer(request_header_fields_too_large);
   case reply::internal_server_error:
     return boost::asio::buffer(internal_server_error);
   case reply::not_implemented:
@@ -104,6 +120,12 @@ const char crlf[] = { '\r', '\n' };
 std::vector<boost::asio::const_buffer> reply::to_buffers()
 {
   std::vector<boost::asio::const_buffer> buffers;
+  append_buffers(buffers);
+  return buffers;
+}
+
+void reply::append_buffers(std::vector<boost::asio::const_buffer>& buffers)
+{
   buffers.push_back(status_strings::to_buffer(status));
   for(const Headers::value_type& header : headers) {
     buffers.push_back(boost::asio::buffer(header.first));
@@ -111,9 +133,28 @@ std::vector<boost::asio::const_buffer> reply::to_buffers()
     buffers.push_back(boost::asio::buffer(header.second));
     buffers.push_back(boost::asio::buffer(misc_strings::crlf));
   }
+  if (shared_headers)
+    buffers.push_back(boost::asio::buffer(*shared_headers));
   buffers.push_back(boost::asio::buffer(misc_strings::crlf));
-  buffers.push_back(boost::asio::buffer(content));
-  return buffers;
+  if (parts.empty())
+  {
+    if (shared_content)
+      buffers.push_back(boost::asio::buffer(*shared_content));
+    else
+      buffers.push_back(boost::asio::buffer(content));
+  }
+  else if (!file)
+  {
+    // Parts of content held in memory are gathered straight from it.
+    for (const body_part& part : parts)
+    {
+      if (!part.header.empty())
+        buffers.push_back(boost::asio::buffer(part.header));
+      buffers.push_back(boost::asio::buffer(
+            shared_content->data() + part.offset, part.length));
+    }
+    buffers.push_back(boost::asio::buffer(content));
+  }
 }
 
 namespace stock_replies {
@@ -134,6 +175,11 @@ const char no_content[] =
   "<head><title>No Content</title></head>"
   "<body><h1>204 Content</h1></body>"
   "</html>";
+const char partial_content[] =
+  "<html>"
+  "<head><title>Partial Content</title></head>"
+  "<body><h1>206 Partial Content</h1></body>"
+  "</html>";
 const char multiple_choices[] =
   "<html>"
   "<head><title>Multiple Choices</title></head>"
@@ -174,6 +220,21 @@ const char not_found[] =
   "<head><title>Not Found</title></head>"
   "<body><h1>404 Not Found</h1></body>"
   "</html>";
+const char payload_too_large[] =
+  "<html>"
+  "<head><title>Payload Too Large</title></head>"
+  "<body><h1>413 Payload Too Large</h1></body>"
+  "</html>";
+const char range_not_satisfiable[] =
+  "<html>"
+  "<head><title>Range Not Satisfiable</title></head>"
+  "<body><h1>416 Range Not Satisfiable</h1></body>"
+  "</html>";
+const char request_header_fields_too_large[] =
+  "<html>"
+  "<head><title>Request Header Fields Too Large</title></head>"
+  "<body><h1>431 Request Header Fields Too Large</h1></body>"
+  "</html>";
 const char internal_server_error[] =
   "<html>"
   "<head><title>Internal Server Error</title></head>"
@@ -207,6 +268,8 @@ std::string to_string(reply::status_type status)
     return accepted;
   case reply::no_content:
     return no_content;
+  case reply::partial_content:
+    return partial_content;
   case reply::multiple_choices:
     return multiple_choices;
   case reply::moved_permanently:
@@ -223,6 +286,12 @@ std::string to_string(reply::status_type status)
     return forbidden;
   case reply::not_found:
     return not_found;
+  case reply::payload_too_large:
+    return payload_too_large;
+  case reply::range_not_satisfiable:
+    return range_not_satisfiable;
+  case reply::request_header_fields_too_large:
+    return request_header_fields_too_large;
   case reply::internal_server_error:
     return internal_server_error;
   case reply::not_implemented:
@@ -14,6 +14,9 @@
 #include <string>
 #include <vector>
 #include <boost/asio.hpp>
+#include "deferred_reply.hpp"
+#include "file_body.hpp"
+#include "reply_stream.hpp"
 #include "http_server_types.h"
 
 namespace http {
@@ -30,6 +33,7 @@ struct reply
     created = 201,
     accepted = 202,
     no_content = 204,
+    partial_content = 206,
     multiple_choices = 300,
     moved_permanently = 301,
     moved_temporarily = 302,
@@ -38,6 +42,9 @@ struct reply
     unauthorized = 401,
     forbidden = 403,
     not_found = 404,
+    payload_too_large = 413,
+    range_not_satisfiable = 416,
+    request_header_fields_too_large = 431,
     internal_server_error = 500,
     not_implemented = 501,
     bad_gateway = 502,
@@ -47,17 +54,77 @@ struct reply
   /// The headers to be included in the reply.
   Headers headers;
 
+  /// Header lines serialized ahead of time, each ending in CRLF, sent after
+  /// headers. Shared between replies and never modified.
+  boost::shared_ptr<const std::string> shared_headers;
+
   /// The content to be sent in the reply.
   std::string content;
 
+  /// Content shared between replies and never modified, sent instead of
+  /// content when set.
+  boost::shared_ptr<const std::string> shared_content;
+
+  /// A file sent with sendfile after the headers instead of content. The
+  /// Content-Length must cover the span of the file being sent.
+  file_body_ptr file;
+
+  /// A span of the body preceded by header bytes of its own, as used for
+  /// the parts of a multipart/byteranges reply.
+  struct body_part
+  {
+    /// Bytes sent ahead of the span, e.g. a multipart boundary and headers.
+    std::string header;
+
+    /// Offset of the span within the file or shared_content.
+    std::size_t offset;
+
+    /// Length of the span.
+    std::size_t length;
+  };
+
+  /// Spans of the file or shared_content sent in order instead of the whole
+  /// body. Content is sent after the last part when parts are used, carrying
+  /// the closing multipart boundary if there is one.
+  std::vector<body_part> parts;
+
+  /// A body produced while it is sent, following the headers instead of
+  /// content. The headers must announce how the body is delimited.
+  reply_stream_ptr stream;
+
+  /// Set while the reply is being produced by an asynchronous handler, the
+  /// connection swaps the completed reply in before writing it.
+  deferred_reply_ptr deferred;
+
   /// Convert the reply into a vector of buffers. The buffers do not own the
   /// underlying memory blocks, therefore the reply object must remain valid and
-  /// not be changed until the write operation has completed.
+  /// not be changed until the write operation has completed. A file body is
+  /// not included and has to be sent after these buffers, as do the parts of
+  /// a file body.
   std::vector<boost::asio::const_buffer> to_buffers();
 
+  /// Append the buffers for the reply to an existing vector, allowing several
+  /// replies to be sent with a single gathered write.
+  void append_buffers(std::vector<boost::asio::const_buffer>& buffers);
+
   /// Get a stock reply.
   static reply stock_reply(status_type status);
 
+  /// Clear the reply so it can be reused on a persistent connection. String
+  /// capacity is retained.
+  void reset()
+  {
+    status = uninitialized;
+    headers.clear();
+    shared_headers.reset();
+    content.clear();
+    shared_content.reset();
+    file.reset();
+    parts.clear();
+    stream.reset();
+    deferred.reset();
+  }
+
   reply() : status(uninitialized) { ; }
 };
 
@@ -0,0 +1,158 @@
+//
+// reply_stream.cpp
+// ~~~~~~~~~~~~~~~~
+//
+
+#include "reply_stream.hpp"
+#include <cstdio>
+
+namespace http {
+namespace server {
+
+reply_stream::reply_stream(std::size_t high_water_mark, bool chunked)
+  : high_water_mark_(high_water_mark),
+    chunked_(chunked),
+    in_flight_(0),
+    finished_(false),
+    taken_last_(false),
+    closed_(false),
+    drain_wanted_(false)
+{
+}
+
+bool reply_stream::write(const char* data, std::size_t size)
+{
+  boost::function<void()> notify;
+  bool accepting;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (finished_ || closed_)
+      return false;
+
+    // An empty chunk would end the body.
+    if (size != 0)
+    {
+      if (chunked_)
+      {
+        char size_line[24];
+        int n = std::snprintf(size_line, sizeof(size_line), "%zx\r\n", size);
+        pending_.append(size_line, n);
+        pending_.append(data, size);
+        pending_.append("\r\n", 2);
+      }
+      else
+      {
+        pending_.append(data, size);
+      }
+      notify.swap(notify_);
+    }
+
+    accepting = pending_.size() + in_flight_ < high_water_mark_;
+    if (!accepting)
+      drain_wanted_ = true;
+  }
+
+  if (notify)
+    notify();
+  return accepting;
+}
+
+bool reply_stream::write(const std::string& data)
+{
+  return write(data.data(), data.size());
+}
+
+void reply_stream::finish()
+{
+  boost::function<void()> notify;
+  boost::function<void()> drain;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (finished_ || closed_)
+      return;
+    finished_ = true;
+    if (chunked_)
+      pending_.append("0\r\n\r\n", 5);
+    notify.swap(notify_);
+
+    // Nothing more will be written, which also lets a drain handler holding
+    // the stream go.
+    drain.swap(drain_handler_);
+  }
+
+  if (notify)
+    notify();
+}
+
+void reply_stream::on_drain(const boost::function<void()>& handler)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  drain_handler_ = handler;
+}
+
+bool reply_stream::closed() const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return closed_;
+}
+
+bool reply_stream::take(std::string& buffer, bool& finished,
+    const boost::function<void()>& notify)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  if (pending_.empty() && !(finished_ && !taken_last_))
+  {
+    notify_ = notify;
+    return false;
+  }
+
+  // Swapping hands the connection's old buffer back for reuse.
+  buffer.swap(pending_);
+  pending_.clear();
+  in_flight_ = buffer.size();
+  finished = finished_;
+  taken_last_ = finished_;
+  return true;
+}
+
+void reply_stream::sent()
+{
+  boost::function<void()> drain;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    in_flight_ = 0;
+    if (drain_wanted_ && pending_.size() < high_water_mark_)
+    {
+      drain_wanted_ = false;
+      drain = drain_handler_;
+    }
+  }
+
+  if (drain)
+    drain();
+}
+
+void reply_stream::close()
+{
+  boost::function<void()> drain;
+  boost::function<void()> notify;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (closed_)
+      return;
+    closed_ = true;
+    pending_.clear();
+    in_flight_ = 0;
+    notify.swap(notify_);
+    drain.swap(drain_handler_);
+  }
+
+  // The producer learns the stream is closed when it next looks. The
+  // connection's notify handler is dropped outside the lock, it may hold the
+  // last reference to the connection.
+  if (drain)
+    drain();
+}
+
+} // namespace server
+} // namespace http
@@ -0,0 +1,110 @@
+//
+// reply_stream.hpp
+// ~~~~~~~~~~~~~~~~
+//
+// A reply body produced a piece at a time and sent while it is produced.
+//
+
+#ifndef HTTP_SERVER_REPLY_STREAM_HPP
+#define HTTP_SERVER_REPLY_STREAM_HPP
+
+#include <cstddef>
+#include <string>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace http {
+namespace server {
+
+/// The body of a streamed reply. The producer writes pieces of the body from
+/// any thread and finishes it, the connection sends them with chunked
+/// transfer-coding as they arrive. Clients speaking HTTP/1.0 get the body as
+/// it is, ended by closing the connection.
+///
+/// Writes are queued without blocking. Once more than the high water mark is
+/// queued and not yet sent write returns false, and the producer should wait
+/// for its drain handler before writing more.
+class reply_stream
+  : private boost::noncopyable
+{
+public:
+  /// Construct for a reply sent with or without chunked transfer-coding.
+  reply_stream(std::size_t high_water_mark, bool chunked);
+
+  /// Queue a piece of the body. Returns false while the producer should
+  /// hold back. Data written once the stream is finished or closed is
+  /// discarded.
+  bool write(const char* data, std::size_t size);
+
+  /// Queue a piece of the body.
+  bool write(const std::string& data);
+
+  /// Complete the body. Nothing more may be written.
+  void finish();
+
+  /// Set the handler called once the connection has caught up after write
+  /// returned false, or when the stream is closed. The handler is called
+  /// from an io thread and may write again straight away.
+  void on_drain(const boost::function<void()>& handler);
+
+  /// Whether the client has gone away, so that producing more is pointless.
+  bool closed() const;
+
+  /// Whether the body is sent with chunked transfer-coding.
+  bool chunked() const { return chunked_; }
+
+  /// Move everything queued into a buffer for the connection to send, with
+  /// finished set if that includes the end of the body. When nothing is
+  /// queued returns false and notify is called as soon as something is.
+  bool take(std::string& buffer, bool& finished,
+      const boost::function<void()>& notify);
+
+  /// Tell the stream what was taken last has been sent.
+  void sent();
+
+  /// Discard the stream because the connection is gone.
+  void close();
+
+private:
+  /// Protects everything below.
+  mutable boost::mutex mutex_;
+
+  /// Queue size past which the producer is asked to hold back.
+  const std::size_t high_water_mark_;
+
+  /// Whether pieces are framed as chunks.
+  const bool chunked_;
+
+  /// Framed data not yet taken by the connection.
+  std::string pending_;
+
+  /// Bytes taken by the connection and still being sent.
+  std::size_t in_flight_;
+
+  /// Whether finish has been called.
+  bool finished_;
+
+  /// Whether the end of the body has been taken.
+  bool taken_last_;
+
+  /// Whether the connection is gone.
+  bool closed_;
+
+  /// Whether a write returned false since the drain handler was last called.
+  bool drain_wanted_;
+
+  /// Called once the producer may write again.
+  boost::function<void()> drain_handler_;
+
+  /// Set while the connection waits for data, holding the connection.
+  boost::function<void()> notify_;
+};
+
+typedef boost::shared_ptr<reply_stream> reply_stream_ptr;
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_SERVER_REPLY_STREAM_HPP
@@ -0,0 +1,48 @@
+//
+// request.cpp
+// ~~~~~~~~~~~
+//
+
+#include "request.hpp"
+#include "request_view.hpp"
+
+namespace http {
+namespace server {
+
+request::request(request_view& view)
+  : method(view.method.data(), view.method.size()),
+    uri(view.uri.data(), view.uri.size()),
+    http_version_major(view.http_version_major),
+    http_version_minor(view.http_version_minor),
+    post_file(view.post_file),
+    body(view.body)
+{
+  // Inserting at the end keeps fields with the same name in arrival order.
+  for (request_fields::const_iterator i = view.headers.begin();
+      i != view.headers.end(); ++i)
+    headers.insert(headers.end(), std::make_pair(i->first.to_string(),
+          i->second.to_string()));
+
+  // Form parameters view post, they are copied before it is taken.
+  for (request_fields::const_iterator i = view.parameters.begin();
+      i != view.parameters.end(); ++i)
+    parameters.insert(parameters.end(), std::make_pair(i->first.to_string(),
+          i->second.to_string()));
+  post.swap(view.post);
+}
+
+void request::reset()
+{
+  method.clear();
+  std::string().swap(post);
+  uri.clear();
+  http_version_major = 0;
+  http_version_minor = 0;
+  headers.clear();
+  parameters.clear();
+  post_file.reset();
+  body.reset();
+}
+
+} // namespace server
+} // namespace http
@@ -15,11 +15,16 @@
 #include <vector>
 #include <map>
 #include "http_server_types.h"
+#include "file_body.hpp"
+#include "request_body.hpp"
 
 namespace http {
 namespace server {
 
-/// A request received from a client.
+struct request_view;
+
+/// A request received from a client, as handed to registered handlers. It
+/// owns its bytes, so a handler may copy it and keep it.
 struct request
 {
   std::string method;
@@ -28,14 +33,28 @@ struct request
   int http_version_major;
   int http_version_minor;
 
+  /// Header names are as the client sent them.
   Headers headers;
-  Headers::key_type header_key;
-  Headers::iterator header_curr;
 
   Parameters parameters;
-  Parameters::key_type parameter_key;
-  Parameters::iterator parameter_curr;
 
+  /// The body when it was too large to hold in memory, in an unlinked
+  /// temporary file whose length is that of the body. Null otherwise, the
+  /// body is then in post.
+  file_body_ptr post_file;
+
+  /// The body as it arrives, for handlers streaming it. Null otherwise, the
+  /// body is then collected in post.
+  request_body_ptr body;
+
+  request() : http_version_major(0), http_version_minor(0) { ; }
+
+  /// Copy a parsed request, taking over its post rather than copying it.
+  explicit request(request_view& view);
+
+  /// Clear the request so it can be reused. String capacity is retained,
+  /// except that of post.
+  void reset();
 };
 
 } // namespace server
@@ -0,0 +1,149 @@
+//
+// request_body.cpp
+// ~~~~~~~~~~~~~~~~
+//
+
+#include "request_body.hpp"
+
+namespace http {
+namespace server {
+
+request_body::request_body(std::size_t length)
+  : length_(length),
+    paused_(false),
+    ended_(false),
+    complete_(false)
+{
+}
+
+void request_body::on_data(
+    const boost::function<void(const char*, std::size_t)>& handler)
+{
+  set_data_handler(handler, true);
+}
+
+void request_body::discard()
+{
+  on_data(&request_body::drop);
+}
+
+void request_body::discard_unclaimed()
+{
+  set_data_handler(&request_body::drop, false);
+}
+
+void request_body::set_data_handler(
+    const boost::function<void(const char*, std::size_t)>& handler,
+    bool replace)
+{
+  boost::function<void()> notify;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (ended_ || (data_handler_ && !replace))
+      return;
+    data_handler_ = handler;
+    if (!paused_)
+      notify.swap(notify_);
+  }
+
+  if (notify)
+    notify();
+}
+
+void request_body::drop(const char*, std::size_t)
+{
+}
+
+void request_body::on_end(const boost::function<void(bool)>& handler)
+{
+  bool complete;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (!ended_)
+    {
+      end_handler_ = handler;
+      return;
+    }
+    complete = complete_;
+  }
+
+  handler(complete);
+}
+
+void request_body::pause()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  paused_ = true;
+}
+
+void request_body::resume()
+{
+  boost::function<void()> notify;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    paused_ = false;
+    if (data_handler_)
+      notify.swap(notify_);
+  }
+
+  if (notify)
+    notify();
+}
+
+bool request_body::ready() const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return data_handler_ && !paused_;
+}
+
+bool request_body::wait(const boost::function<void()>& notify)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  if (data_handler_ && !paused_)
+    return false;
+  notify_ = notify;
+  return true;
+}
+
+void request_body::deliver(const char* data, std::size_t size)
+{
+  // The handler is set once and only replaced by finish, which is called on
+  // this thread, so it is called without the lock and may pause.
+  data_handler_(data, size);
+}
+
+void request_body::end()
+{
+  finish(true);
+}
+
+void request_body::abort()
+{
+  finish(false);
+}
+
+void request_body::finish(bool complete)
+{
+  boost::function<void(const char*, std::size_t)> data_handler;
+  boost::function<void(bool)> end_handler;
+  boost::function<void()> notify;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (ended_)
+      return;
+    ended_ = true;
+    complete_ = complete;
+    data_handler.swap(data_handler_);
+    end_handler.swap(end_handler_);
+    notify.swap(notify_);
+  }
+
+  // The handlers usually hold the body, letting go of them here breaks the
+  // cycle. The connection's notify handler is dropped outside the lock, it
+  // may hold the last reference to the connection.
+  if (end_handler)
+    end_handler(complete);
+}
+
+} // namespace server
+} // namespace http
@@ -0,0 +1,120 @@
+//
+// request_body.hpp
+// ~~~~~~~~~~~~~~~~
+//
+// A request body handed to its handler a fragment at a time as it arrives.
+//
+
+#ifndef HTTP_SERVER_REQUEST_BODY_HPP
+#define HTTP_SERVER_REQUEST_BODY_HPP
+
+#include <cstddef>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace http {
+namespace server {
+
+/// The body of a request whose handler asked for it to be streamed. Rather
+/// than being collected into request::post, each fragment read from the
+/// client is passed to the data handler straight out of the connection's
+/// buffer, on the connection's io thread.
+///
+/// Nothing is delivered before the data handler is set, and nothing while
+/// the consumer has paused the body. Meanwhile the connection stops reading,
+/// so a slow consumer holds back the client instead of piling up data.
+class request_body
+  : private boost::noncopyable
+{
+public:
+  /// Construct for a body of the given length.
+  explicit request_body(std::size_t length);
+
+  /// Length of the body, from the Content-Length of the request.
+  std::size_t length() const { return length_; }
+
+  /// Set the handler called with each fragment of the body, valid only for
+  /// the duration of the call. Set it once, from any thread.
+  void on_data(const boost::function<void(const char*, std::size_t)>& handler);
+
+  /// Read the body and throw it away, for a consumer not interested in it
+  /// after all. Used in place of on_data.
+  void discard();
+
+  /// Discard the body unless a data handler has been set.
+  void discard_unclaimed();
+
+  /// Set the handler called once the whole body has been delivered, with
+  /// true, or once the connection is gone before it was, with false. It is
+  /// called straight away if that has already happened.
+  void on_end(const boost::function<void(bool)>& handler);
+
+  /// Stop delivering fragments until resume is called. May be called from
+  /// within the data handler.
+  void pause();
+
+  /// Carry on delivering fragments, from any thread.
+  void resume();
+
+  /// Whether a fragment may be delivered now.
+  bool ready() const;
+
+  /// Have notify called once a fragment may be delivered. Returns false
+  /// without keeping notify if one already may.
+  bool wait(const boost::function<void()>& notify);
+
+  /// Pass a fragment to the data handler, only once ready.
+  void deliver(const char* data, std::size_t size);
+
+  /// Tell the consumer the whole body has been delivered.
+  void end();
+
+  /// Tell the consumer the body will not be completed because the
+  /// connection is gone.
+  void abort();
+
+private:
+  /// Set the data handler, unless one is set and replace is false.
+  void set_data_handler(
+      const boost::function<void(const char*, std::size_t)>& handler,
+      bool replace);
+
+  /// Data handler ignoring the fragment.
+  static void drop(const char* data, std::size_t size);
+
+  /// Let go of the handlers and tell the consumer how the body ended.
+  void finish(bool complete);
+
+  /// Protects everything below.
+  mutable boost::mutex mutex_;
+
+  /// Length of the body.
+  const std::size_t length_;
+
+  /// Called with each fragment.
+  boost::function<void(const char*, std::size_t)> data_handler_;
+
+  /// Called once the body has ended.
+  boost::function<void(bool)> end_handler_;
+
+  /// Whether the consumer has paused delivery.
+  bool paused_;
+
+  /// Whether the body has ended, completely or not.
+  bool ended_;
+
+  /// Whether the whole body was delivered.
+  bool complete_;
+
+  /// Set while the connection waits to deliver, holding the connection.
+  boost::function<void()> notify_;
+};
+
+typedef boost::shared_ptr<request_body> request_body_ptr;
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_SERVER_REQUEST_BODY_HPP
@@ -9,23 +9,37 @@
 //
 
 #include "request_handler.hpp"
-#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <ctime>
 #include <list>
 #include <sstream>
 #include <string>
+#include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string/trim.hpp>
+#include "content_coding.hpp"
 #include "mime_types.hpp"
 #include "reply.hpp"
 #include "request.hpp"
+#include "request_view.hpp"
 
 namespace http {
   namespace server {
 
-    request_handler::request_handler(const std::string& doc_root)
-    : doc_root_(doc_root) {
+    request_handler::request_handler(const std::string& doc_root,
+            const server_options& options, server_stats& stats,
+            worker_pool& workers)
+    : doc_root_(doc_root), options_(options), stats_(stats), workers_(workers),
+      file_cache_(options, stats) {
     }
 
-    void request_handler::handle_request(const request& req, reply& rep) {
+    void request_handler::start(boost::asio::io_service& io_service) {
+      file_cache_.start(io_service);
+    }
+
+    void request_handler::handle_request(request_view& req, reply& rep,
+            boost::asio::io_service& io_service) {
       // Decode url to path.
       std::string request_path;
       if (!url_decode(req.uri, request_path)) {
@@ -35,25 +49,46 @@ namespace http {
 
       // Request path must be absolute and not contain "..".
       if (request_path.empty() || request_path[0] != '/'
-              || request_path.find("..") != std::string::npos) {
+              || request_path.find("..") != std::string::npos
+              || request_path.find('\0') != std::string::npos) {
         rep = reply::stock_reply(reply::bad_request);
         return;
       }
 
       // Check for a custom handler
-      std::shared_ptr<registered_handler> custom_handler;
-      for (auto iter = custom_handlers.begin(); iter != custom_handlers.end(); iter++) {
-        if (req.uri.find((*iter)->get_service_port()) == 0) {
-          // use the custom handler
-          custom_handler = *iter;
-          break;
-        }
-      }
-
+      std::string accept_encoding = req.headers.value(accept_encoding_header).to_string();
+      std::shared_ptr<registered_handler> custom_handler = find_handler(req.uri);
       if (custom_handler) {
-        bool verified = custom_handler->verify_request(req);
-        if(verified == true) {
-          custom_handler->handle_request(req, rep);
+        request handler_req(req);
+        bool verified = custom_handler->verify_request(handler_req);
+        validators v;
+        bool validated = verified == true && custom_handler->get_validators(handler_req, v);
+        if (validated && is_not_modified(req, v.etag, v.last_modified)) {
+          not_modified_reply(rep, v.etag, v.last_modified);
+          return;
+        }
+        const streaming_handler* streaming = dynamic_cast<const streaming_handler*>(custom_handler.get());
+        const async_handler* async = dynamic_cast<const async_handler*>(custom_handler.get());
+        std::shared_ptr<const coroutine_handler> coroutine = std::dynamic_pointer_cast<const coroutine_handler>(custom_handler);
+        if(verified == true && async) {
+          start_async(*async, handler_req, rep, accept_encoding, v, validated);
+          return;
+        } else if(verified == true && coroutine) {
+          start_coroutine(coroutine, handler_req, rep, io_service, accept_encoding, v, validated);
+          return;
+        } else if(verified == true && streaming) {
+          start_stream(*streaming, handler_req, rep);
+          if (validated)
+            add_validators(rep, v);
+          return;
+        } else if(verified == true && workers_.enabled()
+                && custom_handler->get_execution_policy() == registered_handler::execute_on_worker) {
+          start_on_worker(custom_handler, handler_req, rep, accept_encoding, v, validated);
+          return;
+        } else if(verified == true) {
+          custom_handler->handle_request(handler_req, rep);
+          if (validated)
+            add_validators(rep, v);
         } else {
             rep.headers.insert(std::make_pair(std::string("Content-Type"), mime_types::extension_to_type("text")));
             rep.content = custom_handler->get_parameter_spec();
@@ -74,37 +109,548 @@ namespace http {
           extension = request_path.substr(last_dot_pos + 1);
         }
 
-        // Open the file to send back.
         std::string full_path = doc_root_ + request_path;
-        std::ifstream is(full_path.c_str(), std::ios::in | std::ios::binary);
-        if (!is) {
+        std::string content_type = mime_types::extension_to_type(extension);
+
+        // Ranges are always taken from the file as it is, never from a
+        // compressed variant of it.
+        if (req.headers.find(range_header) != req.headers.end()) {
+          accept_encoding.clear();
+        }
+        file_cache::entry_ptr cached;
+        const file_cache::entry_ptr* found = 0;
+        if (!accept_encoding.empty() && options_.serve_precompressed
+                && mime_types::is_compressible(content_type)) {
+          // A cached file known to have no siblings is served as it is
+          // without looking for them.
+          cached = file_cache_.find(full_path);
+          found = &cached;
+        }
+        if (found && !(cached && cached->no_precompressed)) {
+          // Try the siblings in the order the client prefers them.
+          const char* first = "br";
+          const char* second = "gzip";
+          if (content_coding::quality(accept_encoding, "gzip")
+                  > content_coding::quality(accept_encoding, "br")) {
+            std::swap(first, second);
+          }
+          if (serve_file(req, rep, full_path, content_type, first, accept_encoding)
+                  || serve_file(req, rep, full_path, content_type, second, accept_encoding)) {
+            return;
+          }
+        }
+        if (!serve_file(req, rep, full_path, content_type, std::string(), accept_encoding, found)) {
           rep = reply::stock_reply(reply::not_found);
-          return;
         }
-        char buf[512];
-        while (is.read(buf, sizeof (buf)).gcount() > 0)
-          rep.content.append(buf, is.gcount());
-        ;
-        rep.headers.insert(make_pair(std::string("Content-Type"), mime_types::extension_to_type(extension)));
+        return;
+      }
+      finish_reply(rep, accept_encoding);
+    }
+
+    std::shared_ptr<registered_handler> request_handler::find_handler(boost::string_ref uri) const {
+      for (auto iter = custom_handlers.begin(); iter != custom_handlers.end(); iter++) {
+        if (uri.starts_with((*iter)->get_service_port())) {
+          return *iter;
+        }
       }
+      return std::shared_ptr<registered_handler>();
+    }
+
+    bool request_handler::streams_body(request_view& req) const {
+      std::shared_ptr<registered_handler> custom_handler = find_handler(req.uri);
+      // None of the body has arrived yet, there is no post to take.
+      return custom_handler && custom_handler->streams_request_body()
+              && custom_handler->verify_request(request(req));
+    }
+
+    bool request_handler::spills_body(const request_view& req) const {
+      std::shared_ptr<registered_handler> custom_handler = find_handler(req.uri);
+      return custom_handler && custom_handler->spills_request_body();
+    }
+
+    void request_handler::finish_reply(reply& rep, const std::string& accept_encoding) {
       // Fill out the reply to be sent to the client if one was not filled out by the handler
       if(rep.status == reply::uninitialized)
         rep.status = reply::ok;
-      rep.headers.insert(make_pair("Content-Length", boost::lexical_cast<std::string > (rep.content.size())));
+      if (rep.status == reply::ok)
+        compress_reply(accept_encoding, rep);
+      rep.headers.insert(make_pair("Content-Length", boost::lexical_cast<std::string > (rep.file ? rep.file->length : rep.content.size())));
+    }
+
+    void request_handler::finish_deferred(reply& rep, const std::string& accept_encoding,
+            const validators& v, bool validated) {
+      if (validated)
+        add_validators(rep, v);
+      finish_reply(rep, accept_encoding);
+    }
+
+    void request_handler::start_on_worker(const std::shared_ptr<registered_handler>& handler,
+            const request& req, reply& rep, const std::string& accept_encoding,
+            const validators& v, bool validated) {
+      deferred_reply_ptr deferred(new deferred_reply(boost::bind(&request_handler::finish_deferred,
+              this, _1, accept_encoding, v, validated)));
+
+      // The worker gets its own copy of the request, the connection reuses
+      // its request as soon as this returns.
+      if (!workers_.post(boost::bind(&request_handler::run_on_worker, handler, req, deferred))) {
+        rep = reply::stock_reply(reply::service_unavailable);
+        rep.headers.insert(make_pair(std::string("Retry-After"),
+                boost::lexical_cast<std::string>(options_.retry_after_seconds)));
+        return;
+      }
+      ++stats_.deferred_replies;
+      rep.deferred = deferred;
+    }
+
+    void request_handler::run_on_worker(const std::shared_ptr<registered_handler>& handler,
+            const request& req, const deferred_reply_ptr& deferred) {
+      // Nobody is waiting for the reply once the connection is gone.
+      if (deferred->cancelled()) {
+        return;
+      }
+      reply rep;
+      handler->handle_request(req, rep);
+      deferred->complete(rep);
+    }
+
+    void request_handler::start_async(const async_handler& handler,
+            const request& req, reply& rep, const std::string& accept_encoding,
+            const validators& v, bool validated) {
+      // The request is gone by the time the reply is finished.
+      ++stats_.deferred_replies;
+      rep.deferred.reset(new deferred_reply(boost::bind(&request_handler::finish_deferred,
+              this, _1, accept_encoding, v, validated)));
+      handler.handle_async(req, rep.deferred);
+    }
+
+    void request_handler::start_coroutine(const std::shared_ptr<const coroutine_handler>& handler,
+            const request& req, reply& rep, boost::asio::io_service& io_service,
+            const std::string& accept_encoding, const validators& v, bool validated) {
+      ++stats_.deferred_replies;
+      ++stats_.coroutines_started;
+      rep.deferred.reset(new deferred_reply(boost::bind(&request_handler::finish_deferred,
+              this, _1, accept_encoding, v, validated)));
+
+      // The coroutine gets its own copy of the request, it outlives this call.
+      // Each coroutine runs on a strand of its own.
+      boost::asio::spawn(io_service, boost::bind(&request_handler::run_coroutine,
+              this, handler, req, boost::ref(io_service), rep.deferred, _1),
+              boost::coroutines::attributes(options_.coroutine_stack_size));
+    }
+
+    void request_handler::run_coroutine(const std::shared_ptr<const coroutine_handler>& handler,
+            const request& req, boost::asio::io_service& io_service,
+            const deferred_reply_ptr& deferred, boost::asio::yield_context yield) {
+      // Nobody is waiting for the reply once the connection is gone.
+      if (deferred->cancelled()) {
+        return;
+      }
+      // Counted until the coroutine ends, also when it is destroyed while
+      // suspended and its stack unwinds past the catch below.
+      struct active_coroutine {
+        explicit active_coroutine(std::atomic<std::size_t>& active) : count(active) { ++count; }
+        ~active_coroutine() { --count; }
+        std::atomic<std::size_t>& count;
+      } active(stats_.coroutines_active);
+      reply rep;
+      try {
+        handler->handle_coroutine(req, rep, io_service, yield);
+      } catch (const std::exception&) {
+        // Escaping the coroutine it would end the io thread resuming it. The
+        // stack unwinding a destroyed coroutine is not a std::exception and
+        // passes through.
+        rep = reply::stock_reply(reply::internal_server_error);
+      }
+      deferred->complete(rep);
+    }
+
+    void request_handler::start_stream(const streaming_handler& handler,
+            const request& req, reply& rep) {
+      // Chunked transfer-coding is only understood from HTTP/1.1 on.
+      bool chunked = req.http_version_major > 1
+              || (req.http_version_major == 1 && req.http_version_minor >= 1);
+      ++stats_.streamed_replies;
+      rep.stream.reset(new reply_stream(options_.stream_high_water_mark, chunked));
+      handler.handle_stream(req, rep, rep.stream);
+      if (rep.status == reply::uninitialized)
+        rep.status = reply::ok;
+      rep.headers.erase("Content-Length");
+      if (chunked)
+        rep.headers.insert(make_pair(std::string("Transfer-Encoding"), std::string("chunked")));
+    }
+
+    void request_handler::add_validators(reply& rep, const validators& v) {
+      if (!v.etag.empty() && rep.headers.find("ETag") == rep.headers.end())
+        rep.headers.insert(make_pair(std::string("ETag"), v.etag));
+      if (v.last_modified != 0 && rep.headers.find("Last-Modified") == rep.headers.end())
+        rep.headers.insert(make_pair(std::string("Last-Modified"), file_body::http_date(v.last_modified)));
+    }
+
+    bool request_handler::serve_file(const request_view& req, reply& rep,
+            const std::string& path, const std::string& content_type,
+            const std::string& content_encoding, const std::string& accept_encoding,
+            const file_cache::entry_ptr* found) {
+      if (!content_encoding.empty()
+              && content_coding::quality(accept_encoding, content_encoding) <= 0) {
+        return false;
+      }
+
+      file_cache::entry_ptr cached = found ? *found : file_cache_.find(path, content_encoding);
+      file_body_ptr file;
+      if (!cached) {
+        file = file_body::open(content_encoding.empty()
+                ? path : file_cache::sibling_path(path, content_encoding));
+        if (!file) {
+          return false;
+        }
+        cached = file_cache_.insert(path, *file, content_type, content_encoding);
+      }
+
+      if (cached) {
+        if (cached->content_encoding.empty() && !accept_encoding.empty()) {
+          cached = compressed_variant(cached, accept_encoding);
+        }
+        if (is_not_modified(req, cached->etag, cached->last_modified)) {
+          not_modified_reply(rep, cached->etag, cached->last_modified);
+          return true;
+        }
+        if (range_reply(req, rep, cached->content_type, cached->etag,
+                cached->last_modified, cached->content->size())) {
+          if (rep.status == reply::partial_content) {
+            rep.shared_content = cached->content;
+          }
+          return true;
+        }
+        // The cached headers already carry the Content-Length.
+        rep.status = reply::ok;
+        rep.shared_headers = cached->headers;
+        rep.shared_content = cached->content;
+        if (!cached->content_encoding.empty()) {
+          ++stats_.compressed_replies;
+        }
+        return true;
+      }
+
+      // Not cacheable, the connection streams the file to the socket.
+      if (is_not_modified(req, file->etag(), file->status().st_mtime)) {
+        not_modified_reply(rep, file->etag(), file->status().st_mtime);
+        return true;
+      }
+      if (range_reply(req, rep, content_type, file->etag(),
+              file->status().st_mtime, file->size())) {
+        if (rep.status == reply::partial_content) {
+          rep.file = file;
+        }
+        return true;
+      }
+      rep.status = reply::ok;
+      rep.file = file;
+      rep.headers.insert(make_pair(std::string("Content-Type"), content_type));
+      rep.headers.insert(make_pair(std::string("Last-Modified"), file->last_modified()));
+      rep.headers.insert(make_pair(std::string("ETag"), file->etag()));
+      if (content_encoding.empty()) {
+        rep.headers.insert(make_pair(std::string("Accept-Ranges"), std::string("bytes")));
+      } else {
+        rep.headers.insert(make_pair(std::string("Content-Encoding"), content_encoding));
+        ++stats_.compressed_replies;
+      }
+      if (!content_encoding.empty() || mime_types::is_compressible(content_type)) {
+        rep.headers.insert(make_pair(std::string("Vary"), std::string("Accept-Encoding")));
+      }
+      rep.headers.insert(make_pair(std::string("Content-Length"),
+              boost::lexical_cast<std::string>(file->length)));
+      return true;
+    }
+
+    file_cache::entry_ptr request_handler::compressed_variant(
+            const file_cache::entry_ptr& file, const std::string& accept_encoding) {
+      if (!options_.compress_replies
+              || file->content->size() < options_.compress_min_size
+              || !mime_types::is_compressible(file->content_type)
+              || content_coding::quality(accept_encoding, "gzip") <= 0) {
+        return file;
+      }
+
+      file_cache::entry_ptr variant = file_cache_.find(file->path, "gzip");
+      if (variant) {
+        return variant;
+      }
+      std::string compressed;
+      if (!content_coding::compress("gzip", file->content->data(), file->content->size(),
+              options_.compression_level, compressed)) {
+        return file;
+      }
+      stats_.compression_bytes_in += file->content->size();
+      stats_.compression_bytes_out += compressed.size();
+      if (compressed.size() >= file->content->size()) {
+        return file;
+      }
+      variant = file_cache_.insert_variant(file, "gzip", compressed);
+      return variant ? variant : file;
+    }
+
+    void request_handler::compress_reply(const std::string& accept_encoding, reply& rep) {
+      if (!options_.compress_replies || rep.file || rep.shared_content
+              || !rep.parts.empty() || rep.content.size() < options_.compress_min_size
+              || rep.headers.find("Content-Encoding") != rep.headers.end()) {
+        return;
+      }
+      Headers::iterator type = rep.headers.find("Content-Type");
+      if (type != rep.headers.end() && !mime_types::is_compressible(type->second)) {
+        return;
+      }
+      if (accept_encoding.empty()) {
+        return;
+      }
+
+      double gzip = content_coding::quality(accept_encoding, "gzip");
+      double deflate = content_coding::quality(accept_encoding, "deflate");
+      if (gzip <= 0 && deflate <= 0) {
+        return;
+      }
+      std::string coding = gzip >= deflate ? "gzip" : "deflate";
+      std::string compressed;
+      if (!content_coding::compress(coding, rep.content.data(), rep.content.size(),
+              options_.compression_level, compressed)) {
+        return;
+      }
+      stats_.compression_bytes_in += rep.content.size();
+      stats_.compression_bytes_out += compressed.size();
+      if (compressed.size() >= rep.content.size()) {
+        return;
+      }
+
+      ++stats_.compressed_replies;
+      rep.content.swap(compressed);
+      rep.headers.erase("Content-Length");
+      rep.headers.insert(make_pair(std::string("Content-Encoding"), coding));
+      rep.headers.insert(make_pair(std::string("Vary"), std::string("Accept-Encoding")));
+      // The compressed body is equivalent to the handler's, not identical.
+      Headers::iterator etag = rep.headers.find("ETag");
+      if (etag != rep.headers.end() && etag->second.compare(0, 2, "W/") != 0) {
+        etag->second = "W/" + etag->second;
+      }
     }
 
     void request_handler::register_handler(std::shared_ptr<registered_handler>& handler) {
       custom_handlers.push_back(handler);
     }
 
-    bool request_handler::url_decode(const std::string& in, std::string& out) {
+    bool request_handler::is_not_modified(const request_view& req,
+            const std::string& etag, time_t last_modified) {
+      if (req.method != "GET" && req.method != "HEAD") {
+        return false;
+      }
+
+      // If-None-Match takes precedence, If-Modified-Since is only looked at
+      // when it is absent. Entity tags are compared weakly.
+      request_fields::const_iterator header = req.headers.find(if_none_match_header);
+      if (header != req.headers.end()) {
+        if (etag.empty()) {
+          return false;
+        }
+        std::string current = etag.compare(0, 2, "W/") == 0 ? etag.substr(2) : etag;
+        std::istringstream tags(header->second.to_string());
+        std::string tag;
+        while (std::getline(tags, tag, ',')) {
+          boost::algorithm::trim(tag);
+          if (tag.compare(0, 2, "W/") == 0) {
+            tag.erase(0, 2);
+          }
+          if (tag == "*" || tag == current) {
+            return true;
+          }
+        }
+        return false;
+      }
+
+      header = req.headers.find(if_modified_since_header);
+      time_t since;
+      if (header != req.headers.end() && last_modified != 0
+              && file_body::parse_http_date(header->second.to_string(), since)) {
+        return last_modified <= since;
+      }
+      return false;
+    }
+
+    void request_handler::not_modified_reply(reply& rep, const std::string& etag,
+            time_t last_modified) {
+      // No Content-Length, a 304 never has a body and the length of the
+      // representation it refers to is not known here.
+      rep.reset();
+      rep.status = reply::not_modified;
+      if (!etag.empty()) {
+        rep.headers.insert(make_pair(std::string("ETag"), etag));
+      }
+      if (last_modified != 0) {
+        rep.headers.insert(make_pair(std::string("Last-Modified"), file_body::http_date(last_modified)));
+      }
+    }
+
+    namespace {
+
+      /// Parse a non-empty string of decimal digits.
+      bool parse_size(const std::string& in, std::size_t& out) {
+        if (in.empty()) {
+          return false;
+        }
+        out = 0;
+        for (char c : in) {
+          if (c < '0' || c > '9' || out > (static_cast<std::size_t>(-1) - 9) / 10) {
+            return false;
+          }
+          out = out * 10 + (c - '0');
+        }
+        return true;
+      }
+
+      /// Boundaries only need to be absent from the parts they separate.
+      std::string make_boundary() {
+        static std::atomic<std::size_t> count(0);
+        std::ostringstream boundary;
+        boundary << "byteranges-" << std::hex << ::time(0) << "-" << count++;
+        return boundary.str();
+      }
+
+    } // namespace
+
+    boost::tribool request_handler::parse_ranges(const std::string& header,
+            std::size_t size, std::vector<byte_range>& ranges) const {
+      if (header.compare(0, 6, "bytes=") != 0) {
+        return boost::indeterminate;
+      }
+
+      std::istringstream specs(header.substr(6));
+      std::string spec;
+      std::size_t count = 0;
+      while (std::getline(specs, spec, ',')) {
+        boost::algorithm::trim(spec);
+        if (spec.empty()) {
+          continue;
+        }
+        if (++count > options_.max_ranges) {
+          return boost::indeterminate;
+        }
+        std::size_t dash = spec.find('-');
+        if (dash == std::string::npos) {
+          return boost::indeterminate;
+        }
+        std::size_t first, last;
+        if (dash == 0) {
+          // A suffix of the file, "-500" being its last 500 bytes.
+          if (!parse_size(spec.substr(1), last)) {
+            return boost::indeterminate;
+          }
+          if (last != 0 && size != 0) {
+            ranges.push_back(byte_range(size - std::min(last, size), size - 1));
+          }
+          continue;
+        }
+        if (!parse_size(spec.substr(0, dash), first)) {
+          return boost::indeterminate;
+        }
+        if (dash + 1 == spec.size()) {
+          last = size - 1;
+        } else if (!parse_size(spec.substr(dash + 1), last) || last < first) {
+          return boost::indeterminate;
+        }
+        if (first < size) {
+          ranges.push_back(byte_range(first, std::min(last, size - 1)));
+        }
+      }
+      if (count == 0) {
+        return boost::indeterminate;
+      }
+      return !ranges.empty();
+    }
+
+    bool request_handler::range_reply(const request_view& req, reply& rep,
+            const std::string& content_type, const std::string& etag,
+            time_t last_modified, std::size_t size) {
+      request_fields::const_iterator header = req.headers.find(range_header);
+      if (req.method != "GET" || header == req.headers.end()) {
+        return false;
+      }
+
+      // If-Range makes the ranges conditional on the file being unchanged,
+      // otherwise the whole file is sent.
+      request_fields::const_iterator if_range = req.headers.find(if_range_header);
+      if (if_range != req.headers.end()) {
+        time_t date;
+        bool unchanged = if_range->second.starts_with('"')
+                ? if_range->second == etag
+                : file_body::parse_http_date(if_range->second.to_string(), date) && date == last_modified;
+        if (!unchanged) {
+          return false;
+        }
+      }
+
+      std::vector<byte_range> ranges;
+      boost::tribool result = parse_ranges(header->second.to_string(), size, ranges);
+      if (boost::indeterminate(result)) {
+        return false;
+      }
+      if (!result) {
+        ++stats_.unsatisfiable_ranges;
+        rep = reply::stock_reply(reply::range_not_satisfiable);
+        rep.headers.insert(make_pair(std::string("Content-Range"),
+                "bytes */" + boost::lexical_cast<std::string>(size)));
+        return true;
+      }
+
+      ++stats_.partial_replies;
+      rep.status = reply::partial_content;
+      rep.headers.insert(make_pair(std::string("Last-Modified"), file_body::http_date(last_modified)));
+      rep.headers.insert(make_pair(std::string("ETag"), etag));
+      rep.headers.insert(make_pair(std::string("Accept-Ranges"), std::string("bytes")));
+      std::string total = "/" + boost::lexical_cast<std::string>(size);
+
+      if (ranges.size() == 1) {
+        reply::body_part part = { std::string(), ranges[0].first,
+          ranges[0].second - ranges[0].first + 1 };
+        rep.parts.push_back(part);
+        rep.headers.insert(make_pair(std::string("Content-Type"), content_type));
+        rep.headers.insert(make_pair(std::string("Content-Range"), "bytes "
+                + boost::lexical_cast<std::string>(ranges[0].first) + "-"
+                + boost::lexical_cast<std::string>(ranges[0].second) + total));
+        rep.headers.insert(make_pair(std::string("Content-Length"),
+                boost::lexical_cast<std::string>(part.length)));
+        return true;
+      }
+
+      // Each part carries its own headers ahead of its span, the spans are
+      // sent straight from the file or the cached content.
+      std::string boundary = make_boundary();
+      std::size_t length = 0;
+      for (const byte_range& range : ranges) {
+        reply::body_part part;
+        part.header = (rep.parts.empty() ? "--" : "\r\n--") + boundary
+                + "\r\nContent-Type: " + content_type
+                + "\r\nContent-Range: bytes "
+                + boost::lexical_cast<std::string>(range.first) + "-"
+                + boost::lexical_cast<std::string>(range.second) + total + "\r\n\r\n";
+        part.offset = range.first;
+        part.length = range.second - range.first + 1;
+        length += part.header.size() + part.length;
+        rep.parts.push_back(part);
+      }
+      rep.content = "\r\n--" + boundary + "--\r\n";
+      length += rep.content.size();
+      rep.headers.insert(make_pair(std::string("Content-Type"),
+              "multipart/byteranges; boundary=" + boundary));
+      rep.headers.insert(make_pair(std::string("Content-Length"),
+              boost::lexical_cast<std::string>(length)));
+      return true;
+    }
+
+    bool request_handler::url_decode(boost::string_ref in, std::string& out) {
       out.clear();
       out.reserve(in.size());
       for (std::size_t i = 0; i < in.size(); ++i) {
         if (in[i] == '%') {
           if (i + 3 <= in.size()) {
             int value = 0;
-            std::istringstream is(in.substr(i + 1, 2));
+            std::istringstream is(in.substr(i + 1, 2).to_string());
             if (is >> std::hex >> value) {
               out += static_cast<char> (value);
               i += 2;
@@ -13,8 +13,16 @@
 
 #include <string>
 #include <list>
+#include <utility>
+#include <vector>
+#include <boost/logic/tribool.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/utility/string_ref.hpp>
 #include "registered_handler.h"
+#include "file_cache.hpp"
+#include "server_options.hpp"
+#include "server_stats.hpp"
+#include "worker_pool.hpp"
 #include <memory>
 
 namespace http {
@@ -22,6 +30,7 @@ namespace server {
 
 struct reply;
 struct request;
+struct request_view;
 
 /// The common handler for all incoming requests.
 class request_handler
@@ -30,10 +39,27 @@ class request_handler
   friend class status_handler;
 public:
   /// Construct with a directory containing files to be served.
-  explicit request_handler(const std::string& doc_root);
+  explicit request_handler(const std::string& doc_root,
+      const server_options& options, server_stats& stats,
+      worker_pool& workers);
 
-  /// Handle a request and produce a reply.
-  void handle_request(const request& req, reply& rep);
+  /// Start watching the directory for changes to cached files, using the
+  /// given io_service.
+  void start(boost::asio::io_service& io_service);
+
+  /// Handle a request and produce a reply. Handlers completing their reply
+  /// later run on the given io_service, that of the connection. A
+  /// registered handler gets the request converted, taking over its post.
+  void handle_request(request_view& req, reply& rep,
+      boost::asio::io_service& io_service);
+
+  /// Whether the handler of a request whose headers have just arrived
+  /// streams its body rather than waiting for all of it.
+  bool streams_body(request_view& req) const;
+
+  /// Whether the handler of a request whose headers have just arrived takes
+  /// a large body in a temporary file.
+  bool spills_body(const request_view& req) const;
 
   /// Register a custom handler
   void register_handler(std::shared_ptr<registered_handler>& handler);
@@ -42,12 +68,114 @@ private:
   /// The directory containing the files to be served.
   std::string doc_root_;
 
+  /// Options of the server.
+  const server_options& options_;
+
+  /// Counters of the server.
+  server_stats& stats_;
+
+  /// Runs handlers asking for a worker.
+  worker_pool& workers_;
+
+  /// Small static files held in memory.
+  file_cache file_cache_;
+
   /// Collection of custom handlers
   std::list<std::shared_ptr<registered_handler>> custom_handlers;
 
+  /// The custom handler registered for the URI of a request, null if there
+  /// is none.
+  std::shared_ptr<registered_handler> find_handler(boost::string_ref uri) const;
+
+  /// Give a streaming handler the stream for the body of its reply, and
+  /// frame the reply to match.
+  void start_stream(const streaming_handler& handler, const request& req,
+      reply& rep);
+
+  /// Add validators a handler supplied to its reply, unless it set its own.
+  static void add_validators(reply& rep, const validators& v);
+
+  /// Fill in the reply for a static file, in the given content coding if
+  /// there is one, from the cache or streaming it from disk. Returns false
+  /// if there is no such file. When found is given the cache was already
+  /// searched for the file and found holds the result.
+  bool serve_file(const request_view& req, reply& rep, const std::string& path,
+      const std::string& content_type, const std::string& content_encoding,
+      const std::string& accept_encoding, const file_cache::entry_ptr* found = 0);
+
+  /// The cached gzip variant of a cached file, compressing it first if
+  /// need be, or the file itself if it is not worth compressing or the
+  /// client does not accept gzip.
+  file_cache::entry_ptr compressed_variant(const file_cache::entry_ptr& file,
+      const std::string& accept_encoding);
+
+  /// Compress the content a handler produced if the client accepts gzip or
+  /// deflate and it is large enough to be worth it.
+  void compress_reply(const std::string& accept_encoding, reply& rep);
+
+  /// Complete the reply a handler produced before it is sent.
+  void finish_reply(reply& rep, const std::string& accept_encoding);
+
+  /// Complete the reply of an asynchronous handler before it is sent.
+  void finish_deferred(reply& rep, const std::string& accept_encoding,
+      const validators& v, bool validated);
+
+  /// Queue a request for a handler to run on the worker pool, leaving a
+  /// deferred reply in rep, or a 503 reply when the queue is full.
+  void start_on_worker(const std::shared_ptr<registered_handler>& handler,
+      const request& req, reply& rep, const std::string& accept_encoding,
+      const validators& v, bool validated);
+
+  /// Run a handler on a worker and deliver its reply.
+  static void run_on_worker(const std::shared_ptr<registered_handler>& handler,
+      const request& req, const deferred_reply_ptr& deferred);
+
+  /// Hand a request to an asynchronous handler, leaving a deferred reply in
+  /// rep for the connection to wait on.
+  void start_async(const async_handler& handler, const request& req,
+      reply& rep, const std::string& accept_encoding, const validators& v,
+      bool validated);
+
+  /// Start a coroutine running a coroutine handler on the io_service,
+  /// leaving a deferred reply in rep for the connection to wait on.
+  void start_coroutine(const std::shared_ptr<const coroutine_handler>& handler,
+      const request& req, reply& rep, boost::asio::io_service& io_service,
+      const std::string& accept_encoding, const validators& v, bool validated);
+
+  /// Body of the coroutine running a coroutine handler.
+  void run_coroutine(const std::shared_ptr<const coroutine_handler>& handler,
+      const request& req, boost::asio::io_service& io_service,
+      const deferred_reply_ptr& deferred, boost::asio::yield_context yield);
+
+  /// Whether a conditional GET or HEAD request can be answered with 304 Not
+  /// Modified given the current validators of the resource.
+  static bool is_not_modified(const request_view& req, const std::string& etag,
+      time_t last_modified);
+
+  /// Fill in a body-less 304 Not Modified reply carrying the validators.
+  static void not_modified_reply(reply& rep, const std::string& etag,
+      time_t last_modified);
+
+  /// The first and last byte of a range of a file.
+  typedef std::pair<std::size_t, std::size_t> byte_range;
+
+  /// Parse the value of a Range header for a file of the given size. Returns
+  /// true with the satisfiable ranges, false when none are satisfiable, or
+  /// indeterminate when the header is malformed or asks for too many ranges
+  /// and is ignored.
+  boost::tribool parse_ranges(const std::string& header, std::size_t size,
+      std::vector<byte_range>& ranges) const;
+
+  /// Fill in a 206 or 416 reply if a GET request asks for ranges of a file,
+  /// leaving the caller to attach the file or its content to a 206 reply.
+  /// Returns false if the whole file is to be sent.
+  bool range_reply(const request_view& req, reply& rep,
+      const std::string& content_type, const std::string& etag,
+      time_t last_modified, std::size_t size);
+
   /// Perform URL-decoding on a string. Returns false if the encoding was
   /// invalid.
-  static bool url_decode(const std::string& in, std::string& out);
+  static bool url_decode(boost::string_ref in, std::string& out);
 };
 
 } // namespace server
@@ -9,119 +9,170 @@
 //
 
 #include "request_parser.hpp"
-#include "request.hpp"
+#include "byte_set.hpp"
+#include "request_view.hpp"
 
 namespace http {
   namespace server {
 
+    namespace {
+
+      // Bytes ending a run of each state. Those ending a token are a
+      // superset, '|' and '~' are token characters but share a range with
+      // the bytes above 127. consume sorts them out.
+      const byte_set token_end("\x00\x20\x22\x22\x28\x29\x2c\x2c\x2f\x2f\x3a\x40\x5b\x5d\x7b\xff", 16);
+      const byte_set uri_end("\x00\x20\x3f\x3f\x7f\x7f", 6);
+      const byte_set param_name_end("  &&==", 6);
+      const byte_set param_value_end("  &&", 4);
+      const byte_set header_value_end("\x00\x1f\x7f\x7f", 4);
+
+    } // namespace
+
     request_parser::request_parser()
-    : state_(method_start) {
+    : state_(method_start), body_start_(false), body_remaining_(0), unsupported_(false) {
     }
 
     void request_parser::reset() {
       state_ = method_start;
+      body_start_ = false;
+      body_remaining_ = 0;
+      unsupported_ = false;
+    }
+
+    bool request_parser::started() const {
+      return state_ != method_start;
+    }
+
+    bool request_parser::in_body() const {
+      switch (state_) {
+        case post_param_start:
+        case post_param_name:
+        case post_param_value:
+        case message_body:
+          return true;
+        default:
+          return false;
+      }
     }
 
-    boost::tribool request_parser::consume(request& req, char input) {
+    boost::tribool request_parser::consume(request_view& req, const char* input) {
+      char c = *input;
       switch (state_) {
         case method_start:
-          if (!is_char(input) || is_ctl(input) || is_tspecial(input)) {
+          if (!is_char(c) || is_ctl(c) || is_tspecial(c)) {
             return false;
           } else {
             state_ = method;
-            req.method.push_back(input);
+            extend(req.method, input, input + 1);
             return boost::indeterminate;
           }
         case method:
-          if (input == ' ') {
+          if (c == ' ') {
             state_ = uri;
             return boost::indeterminate;
-          } else if (!is_char(input) || is_ctl(input) || is_tspecial(input)) {
+          } else if (!is_char(c) || is_ctl(c) || is_tspecial(c)) {
             return false;
           } else {
-            req.method.push_back(input);
+            extend(req.method, input, input + 1);
             return boost::indeterminate;
           }
         case uri:
-          switch (input) {
+          switch (c) {
             case '?':
               state_ = url_param_start;
-              req.uri.push_back(input);
+              extend(req.uri, input, input + 1);
               break;
             case ' ':
               state_ = http_version_h;
               break;
             default:
-              if (is_ctl(input)) {
+              if (is_ctl(c)) {
                 return false;
               } else {
-                req.uri.push_back(input);
+                extend(req.uri, input, input + 1);
               }
               break;
           }
           return boost::indeterminate;
         case url_param_start:
-          state_ = url_param_name;
-          req.parameter_key.clear();
-          req.parameter_key.push_back(input);
-          req.uri.push_back(input);
+          switch (c) {
+            case ' ':
+              state_ = http_version_h;
+              return boost::indeterminate;
+            case '&':
+              break;
+            default:
+              state_ = url_param_name;
+              req.parameters.push_back(request_fields::value_type(boost::string_ref(input, 1), boost::string_ref()));
+              break;
+          }
+          extend(req.uri, input, input + 1);
           return boost::indeterminate;
         case url_param_name:
-          switch (input) {
+          // A name without '=' is not a parameter. It still ends at '&' or
+          // at the end of the URI.
+          switch (c) {
             case '=':
               state_ = url_param_value;
-              req.parameter_curr = req.parameters.insert(std::make_pair(req.parameter_key, ""));
               break;
+            case '&':
+              req.parameters.pop_back();
+              state_ = url_param_start;
+              break;
+            case ' ':
+              req.parameters.pop_back();
+              state_ = http_version_h;
+              return boost::indeterminate;
             default:
-              req.parameter_key.push_back(input);
+              extend(req.parameters.back().first, input, input + 1);
               break;
           }
-          req.uri.push_back(input);
+          extend(req.uri, input, input + 1);
           return boost::indeterminate;
         case url_param_value:
-          switch (input) {
+          switch (c) {
             case '&':
               state_ = url_param_start;
               break;
             case ' ':
               state_ = http_version_h;
-              break;
+              return boost::indeterminate;
             default:
-              req.parameter_curr->second.push_back(input);
+              extend(req.parameters.back().second, input, input + 1);
               break;
           }
-          req.uri.push_back(input);
+          extend(req.uri, input, input + 1);
           return boost::indeterminate;
         case http_version_h:
-          if (input == 'H') {
+          if (c == 'H') {
             state_ = http_version_t_1;
             return boost::indeterminate;
           } else {
             return false;
           }
         case http_version_t_1:
-          if (input == 'T') {
+          if (c == 'T') {
             state_ = http_version_t_2;
             return boost::indeterminate;
           } else {
             return false;
           }
         case http_version_t_2:
-          if (input == 'T') {
+          if (c == 'T') {
             state_ = http_version_p;
             return boost::indeterminate;
           } else {
             return false;
           }
         case http_version_p:
-          if (input == 'P') {
+          if (c == 'P') {
             state_ = http_version_slash;
             return boost::indeterminate;
           } else {
             return false;
           }
         case http_version_slash:
-          if (input == '/') {
+          if (c == '/') {
             req.http_version_major = 0;
             req.http_version_minor = 0;
             state_ = http_version_major_start;
@@ -130,175 +181,270 @@ namespace http {
             return false;
           }
         case http_version_major_start:
-          if (is_digit(input)) {
-            req.http_version_major = req.http_version_major * 10 + input - '0';
+          if (is_digit(c)) {
+            req.http_version_major = req.http_version_major * 10 + c - '0';
             state_ = http_version_major;
             return boost::indeterminate;
           } else {
             return false;
           }
         case http_version_major:
-          if (input == '.') {
+          if (c == '.') {
             state_ = http_version_minor_start;
             return boost::indeterminate;
-          } else if (is_digit(input)) {
-            req.http_version_major = req.http_version_major * 10 + input - '0';
+          } else if (is_digit(c)) {
+            req.http_version_major = req.http_version_major * 10 + c - '0';
             return boost::indeterminate;
           } else {
             return false;
           }
         case http_version_minor_start:
-          if (is_digit(input)) {
-            req.http_version_minor = req.http_version_minor * 10 + input - '0';
+          if (is_digit(c)) {
+            req.http_version_minor = req.http_version_minor * 10 + c - '0';
             state_ = http_version_minor;
             return boost::indeterminate;
           } else {
             return false;
           }
         case http_version_minor:
-          if (input == '\r') {
+          if (c == '\r') {
             state_ = expecting_newline_1;
             return boost::indeterminate;
-          } else if (is_digit(input)) {
-            req.http_version_minor = req.http_version_minor * 10 + input - '0';
+          } else if (is_digit(c)) {
+            req.http_version_minor = req.http_version_minor * 10 + c - '0';
             return boost::indeterminate;
           } else {
             return false;
           }
         case expecting_newline_1:
-          if (input == '\n') {
+          if (c == '\n') {
             state_ = header_line_start;
             return boost::indeterminate;
           } else {
             return false;
           }
         case header_line_start:
-          if (input == '\r') {
+          if (c == '\r') {
             state_ = expecting_newline_3;
             return boost::indeterminate;
-          } else if (!req.headers.empty() && (input == ' ' || input == '\t')) {
+          } else if (!req.headers.empty() && (c == ' ' || c == '\t')) {
             state_ = header_lws;
             return boost::indeterminate;
-          } else if (!is_char(input) || is_ctl(input) || is_tspecial(input)) {
+          } else if (!is_char(c) || is_ctl(c) || is_tspecial(c)) {
             return false;
           } else {
-            req.header_key.clear();
-            req.header_key.push_back(input);
+            req.headers.push_back(request_fields::value_type(boost::string_ref(input, 1), boost::string_ref()));
             state_ = header_name;
             return boost::indeterminate;
           }
         case header_lws:
-          if (input == '\r') {
+          // A folded line continues the value of the header before it.
+          if (c == '\r') {
             state_ = expecting_newline_2;
             return boost::indeterminate;
-          } else if (input == ' ' || input == '\t') {
+          } else if (c == ' ' || c == '\t') {
             return boost::indeterminate;
-          } else if (is_ctl(input)) {
+          } else if (is_ctl(c)) {
             return false;
           } else {
-            state_ = header_value;
-            req.header_curr->second.push_back(input);
+            state_ = folded_header_value;
+            req.fold_back(input, input + 1);
             return boost::indeterminate;
           }
         case header_name:
-          if (input == ':') {
+          if (c == ':') {
+            // A second length could be read differently by a proxy in front
+            // of us.
+            header_id id = identify_header(req.headers.back().first);
+            if (!req.headers.identify_back(id) && id == content_length_header) {
+              return false;
+            }
             state_ = space_before_header_value;
-            req.header_curr = req.headers.insert(std::make_pair(req.header_key, ""));
             return boost::indeterminate;
-          } else if (!is_char(input) || is_ctl(input) || is_tspecial(input)) {
+          } else if (!is_char(c) || is_ctl(c) || is_tspecial(c)) {
             return false;
           } else {
-            req.header_key.push_back(input);
+            extend(req.headers.back().first, input, input + 1);
             return boost::indeterminate;
           }
         case space_before_header_value:
-          if (input == ' ') {
+          if (c == ' ') {
             state_ = header_value;
             return boost::indeterminate;
           } else {
             return false;
           }
         case header_value:
-          if (input == '\r') {
+          if (c == '\r') {
             state_ = expecting_newline_2;
             return boost::indeterminate;
-          } else if (is_ctl(input)) {
+          } else if (is_ctl(c)) {
             return false;
           } else {
-            req.header_curr->second.push_back(input);
+            extend(req.headers.back().second, input, input + 1);
+            return boost::indeterminate;
+          }
+        case folded_header_value:
+          if (c == '\r') {
+            state_ = expecting_newline_2;
+            return boost::indeterminate;
+          } else if (is_ctl(c)) {
+            return false;
+          } else {
+            req.fold_back(input, input + 1);
             return boost::indeterminate;
           }
         case expecting_newline_2:
-          if (input == '\n') {
+          if (c == '\n') {
             state_ = header_line_start;
             return boost::indeterminate;
           } else {
             return false;
           }
           break;
-        case message_body:
-          req.post.push_back(input);
-          // If we have read the entirety of the post data (reserved in message_body_start) then we are done processing the request
-          if (req.post.size() == req.post.capacity()) {
-            return true;
-          } else {
-            return boost::indeterminate;
-          }
-          break;
         case expecting_newline_3:
-          if (input == '\n') {
-            if (req.method == "POST") {
-              Headers::iterator header = req.headers.find("Content-Length");
-              if (header != req.headers.end()) {
-                req.post.reserve(atoi(header->second.c_str()));
-              }
-              // If there isn't a match on the form encoding, it must be a post
-              state_ = message_body; // Default to standard message body
-              header = req.headers.find("Content-Type");
-              if (header != req.headers.end() && header->second.find("x-www-form-urlencoded") != std::string::npos) {
-                state_ = post_param_start; // Override it if the content type was html forms
-              }
-            } else {
+          if (c == '\n') {
+            // Any method may carry a body, framed by its Content-Length.
+            // Chunked bodies are not supported.
+            if (req.headers.find(transfer_encoding_header) != req.headers.end()) {
+              unsupported_ = true;
+              return false;
+            }
+            request_fields::const_iterator header = req.headers.find(content_length_header);
+            if (header != req.headers.end() && !parse_length(header->second, req.content_length)) {
+              return false;
+            }
+            body_remaining_ = req.content_length;
+            if (body_remaining_ == 0) {
               return true;
             }
+            // If there isn't a match on the form encoding, it must be a post
+            state_ = message_body; // Default to standard message body
+            if (req.headers.value(content_type_header).find("x-www-form-urlencoded") != boost::string_ref::npos) {
+              state_ = post_param_start; // Override it if the content type was html forms
+            }
+            body_start_ = true;
+            return boost::indeterminate;
+          } else {
+            return false;
           }
-          return boost::indeterminate;
+        default:
+          return false;
+          break;
+      }
+    }
+
+    const char* request_parser::consume_run(request_view& req, const char* begin, const char* end) {
+      const char* stop;
+      switch (state_) {
+        case method:
+          stop = token_end.find(begin, end);
+          extend(req.method, begin, stop);
+          return stop;
+        case uri:
+          stop = uri_end.find(begin, end);
+          extend(req.uri, begin, stop);
+          return stop;
+        case url_param_name:
+          stop = param_name_end.find(begin, end);
+          extend(req.parameters.back().first, begin, stop);
+          extend(req.uri, begin, stop);
+          return stop;
+        case url_param_value:
+          stop = param_value_end.find(begin, end);
+          extend(req.parameters.back().second, begin, stop);
+          extend(req.uri, begin, stop);
+          return stop;
+        case header_name:
+          stop = token_end.find(begin, end);
+          extend(req.headers.back().first, begin, stop);
+          return stop;
+        case header_value:
+          stop = header_value_end.find(begin, end);
+          extend(req.headers.back().second, begin, stop);
+          return stop;
+        case folded_header_value:
+          stop = header_value_end.find(begin, end);
+          req.fold_back(begin, stop);
+          return stop;
+        default:
+          return begin;
+      }
+    }
+
+    void request_parser::consume_body(request_view& req, const char* data, std::size_t size) {
+      // Reserving for the whole body up front avoids regrowing the string,
+      // which also keeps the views of form parameters into it valid. The
+      // connection only lets a body this far once it has checked its
+      // length against max_body_size and max_body_memory.
+      if (req.post.empty()) {
+        req.post.reserve(body_remaining_);
+      }
+      std::size_t offset = req.post.size();
+      req.post.append(data, size);
+      body_remaining_ -= size;
+      if (state_ != message_body) {
+        for (const char* p = req.post.data() + offset; p != req.post.data() + req.post.size(); ++p) {
+          consume_form(req, p);
+        }
+        if (body_remaining_ == 0 && state_ == post_param_name) {
+          req.parameters.pop_back();
+        }
+      }
+    }
+
+    void request_parser::consume_form(request_view& req, const char* input) {
+      switch (state_) {
         case post_param_start:
-          req.post.push_back(input);
-          req.parameter_key.clear();
-          req.parameter_key.push_back(input);
-          state_ = post_param_name;
-          if (req.post.size() == req.post.capacity()) return true;
-          else return boost::indeterminate;
+          if (*input != '&') {
+            req.parameters.push_back(request_fields::value_type(boost::string_ref(input, 1), boost::string_ref()));
+            state_ = post_param_name;
+          }
           break;
         case post_param_name:
-          req.post.push_back(input);
-          if (input == '=') {
-            req.parameter_curr = req.parameters.insert(std::make_pair(req.parameter_key, ""));
+          if (*input == '=') {
             state_ = post_param_value;
+          } else if (*input == '&') {
+            req.parameters.pop_back();
+            state_ = post_param_start;
           } else {
-            req.parameter_key.push_back(input);
+            extend(req.parameters.back().first, input, input + 1);
           }
-          if (req.post.size() == req.post.capacity()) return true;
-          else return boost::indeterminate;
-          return boost::indeterminate;
           break;
         case post_param_value:
-          req.post.push_back(input);
-          if (input == '&') {
+          if (*input == '&') {
             state_ = post_param_start;
           } else {
-            req.parameter_curr->second.push_back(input);
+            extend(req.parameters.back().second, input, input + 1);
           }
-          if (req.post.size() == req.post.capacity()) return true;
-          else return boost::indeterminate;
           break;
         default:
-          return false;
           break;
       }
     }
 
+    void request_parser::extend(boost::string_ref& view, const char* begin, const char* end) {
+      if (view.empty()) {
+        view = boost::string_ref(begin, end - begin);
+      } else {
+        view = boost::string_ref(view.data(), end - view.data());
+      }
+    }
+
+    bool request_parser::parse_length(boost::string_ref value, std::size_t& length) {
+      if (value.empty()) {
+        return false;
+      }
+      length = 0;
+      for (boost::string_ref::const_iterator i = value.begin(); i != value.end(); ++i) {
+        if (!is_digit(*i) || length > (static_cast<std::size_t>(-1) - 9) / 10) {
+          return false;
+        }
+        length = length * 10 + (*i - '0');
+      }
+      return true;
+    }
+
     bool request_parser::is_char(int c) {
 
       return c >= 0 && c <= 127;
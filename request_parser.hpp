@@ -11,15 +11,18 @@
 #ifndef HTTP_SERVER_REQUEST_PARSER_HPP
 #define HTTP_SERVER_REQUEST_PARSER_HPP
 
+#include <algorithm>
+#include <cstddef>
+#include <string>
 #include <boost/logic/tribool.hpp>
 #include <boost/tuple/tuple.hpp>
 
-#include "request.hpp"
+#include "request_view.hpp"
 
 namespace http {
 namespace server {
 
-struct request;
+struct request_view;
 
 /// Parser for incoming requests.
 class request_parser
@@ -31,18 +34,59 @@ public:
   /// Reset to initial parser state.
   void reset();
 
+  /// Whether any part of a request has been consumed since the last reset.
+  bool started() const;
+
+  /// Whether the headers are complete and the body is being consumed.
+  bool in_body() const;
+
+  /// Whether the last call to parse stopped at the end of the headers of a
+  /// request with a body, before consuming any of it.
+  bool at_body_start() const { return body_start_; }
+
+  /// Bytes of the body still to be consumed.
+  std::size_t body_remaining() const { return body_remaining_; }
+
+  /// Whether the last call to parse rejected a request that is well formed
+  /// but asks for something not implemented, a transfer-coding of its body.
+  bool unsupported() const { return unsupported_; }
+
   /// Parse some data. The tribool return value is true when a complete request
   /// has been parsed, false if the data is invalid, indeterminate when more
   /// data is required. The InputIterator return value indicates how much of the
   /// input has been consumed.
+  ///
+  /// The request views the data rather than copying it. Everything passed in
+  /// since the last reset, up to the start of the body, must stay where it
+  /// is and follow on from what was passed before, or be moved together with
+  /// request_view::relocate.
   template <typename InputIterator>
-  boost::tuple<boost::tribool, InputIterator> parse(request& req,
+  boost::tuple<boost::tribool, InputIterator> parse(request_view& req,
       InputIterator begin, InputIterator end)
   {
+    body_start_ = false;
     while (begin != end)
     {
-      boost::tribool result = consume(req, *begin++);
-      if (result || !result)
+      if (in_body())
+      {
+        // The body is taken a span at a time, its length is known.
+        std::size_t size = std::min<std::size_t>(end - begin, body_remaining_);
+        consume_body(req, &*begin, size);
+        begin += size;
+        if (body_remaining_ == 0)
+          return boost::make_tuple(boost::tribool(true), begin);
+        break;
+      }
+
+      // Runs of ordinary characters are taken in one go, the state machine
+      // only sees the byte ending each run.
+      const char* run = &*begin;
+      begin += consume_run(req, run, run + (end - begin)) - run;
+      if (begin == end)
+        break;
+
+      boost::tribool result = consume(req, &*begin++);
+      if (result || !result || body_start_)
         return boost::make_tuple(result, begin);
     }
     boost::tribool result = boost::indeterminate;
@@ -51,7 +95,27 @@ public:
 
 private:
   /// Handle the next character of input.
-  boost::tribool consume(request& req, char input);
+  boost::tribool consume(request_view& req, const char* input);
+
+  /// Take the longest run of input the current state would consume one
+  /// character at a time without changing state. Returns the end of the run.
+  const char* consume_run(request_view& req, const char* begin, const char* end);
+
+  /// Handle the next span of the body.
+  void consume_body(request_view& req, const char* data, std::size_t size);
+
+  /// Handle the next character of a form body, held in post, collecting its
+  /// parameters.
+  void consume_form(request_view& req, const char* input);
+
+  /// Extend a view to end at end, or start it at begin if it is empty. The
+  /// bytes of a view are contiguous.
+  static void extend(boost::string_ref& view, const char* begin,
+      const char* end);
+
+  /// Parse the value of a Content-Length header. Returns false if it is not
+  /// a number.
+  static bool parse_length(boost::string_ref value, std::size_t& length);
 
   /// Check if a byte is an HTTP character.
   static bool is_char(int c);
@@ -86,6 +150,7 @@ private:
     header_name,
     space_before_header_value,
     header_value,
+    folded_header_value, // The value of a header continued on a folded line
     expecting_newline_2, // Newlines found while processing headers
     expecting_newline_3, // The last newline found in the request, signals the end
     url_param_start,
@@ -96,6 +161,16 @@ private:
     post_param_value,
     message_body
   } state_;
+
+  /// Set when the headers of a request with a body have just been consumed.
+  bool body_start_;
+
+  /// Bytes of the body still to be consumed.
+  std::size_t body_remaining_;
+
+  /// Set when a request is rejected for asking for something not
+  /// implemented.
+  bool unsupported_;
 };
 
 } // namespace server
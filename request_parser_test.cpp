@@ -0,0 +1,405 @@
+//
+// request_parser_test.cpp
+// ~~~~~~~~~~~~~~~~~~~~~~~
+//
+// Feeds the parser whole and split requests and checks what it makes of
+// them.
+//
+
+#define BOOST_TEST_MODULE request_parser_test
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <string>
+#include "header_id.hpp"
+#include "request.hpp"
+#include "request_view.hpp"
+#include "request_parser.hpp"
+
+using namespace http::server;
+
+namespace {
+
+/// The outcome of one call to request_parser::parse.
+struct parsed
+{
+  boost::tribool result;
+  std::size_t consumed;
+
+  bool complete() const { return bool(result); }
+  bool failed() const { return bool(!result); }
+};
+
+/// The request views what it was parsed from, so each part of a request
+/// is parsed from its place in one buffer that outlives the request.
+parsed parse(request_parser& parser, request_view& req, const char* begin, const char* end)
+{
+  parsed p;
+  const char* stop;
+  boost::tie(p.result, stop) = parser.parse(req, begin, end);
+  p.consumed = stop - begin;
+  return p;
+}
+
+parsed parse(request_parser& parser, request_view& req, const std::string& data)
+{
+  return parse(parser, req, data.data(), data.data() + data.size());
+}
+
+/// Parse data as the connection does, carrying on past the start of a
+/// body.
+parsed parse_through_body(request_parser& parser, request_view& req, const char* begin, const char* end)
+{
+  parsed p = parse(parser, req, begin, end);
+  if (boost::indeterminate(p.result) && parser.at_body_start())
+  {
+    parsed rest = parse(parser, req, begin + p.consumed, end);
+    rest.consumed += p.consumed;
+    return rest;
+  }
+  return p;
+}
+
+parsed parse_through_body(request_parser& parser, request_view& req, const std::string& data)
+{
+  return parse_through_body(parser, req, data.data(), data.data() + data.size());
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(request_line_and_headers)
+{
+  request_parser parser;
+  request_view req;
+  std::string data = "GET /a/b?x=1&y=2 HTTP/1.1\r\nHost: localhost\r\nAccept: */*\r\n\r\n";
+  parsed p = parse(parser, req, data);
+  BOOST_CHECK(p.complete());
+  BOOST_CHECK_EQUAL(p.consumed, data.size());
+  BOOST_CHECK_EQUAL(req.method, "GET");
+  BOOST_CHECK_EQUAL(req.uri.substr(0, 12), "/a/b?x=1&y=2");
+  BOOST_CHECK_EQUAL(req.http_version_major, 1);
+  BOOST_CHECK_EQUAL(req.http_version_minor, 1);
+  BOOST_CHECK_EQUAL(req.headers.find("Host")->second, "localhost");
+  BOOST_CHECK_EQUAL(req.headers.find("Accept")->second, "*/*");
+  BOOST_CHECK_EQUAL(req.parameters.find("x")->second, "1");
+  BOOST_CHECK_EQUAL(req.parameters.find("y")->second, "2");
+}
+
+BOOST_AUTO_TEST_CASE(request_split_across_reads)
+{
+  request_parser parser;
+  request_view req;
+  std::string data = "GET /split HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  for (std::size_t i = 0; i < data.size() - 1; ++i)
+  {
+    parsed p = parse(parser, req, data.data() + i, data.data() + i + 1);
+    BOOST_REQUIRE(boost::indeterminate(p.result));
+    BOOST_CHECK_EQUAL(p.consumed, 1u);
+  }
+  BOOST_CHECK(parse(parser, req, data.data() + data.size() - 1, data.data() + data.size()).complete());
+  BOOST_CHECK_EQUAL(req.uri, "/split");
+}
+
+BOOST_AUTO_TEST_CASE(parsing_stops_at_the_end_of_a_request)
+{
+  // Pipelined requests arrive together, each is parsed from where the last
+  // one ended.
+  request_parser parser;
+  request_view req;
+  std::string first = "GET /first HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  std::string second = "GET /second HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  std::string data = first + second;
+  parsed p = parse(parser, req, data);
+  BOOST_CHECK(p.complete());
+  BOOST_CHECK_EQUAL(p.consumed, first.size());
+  BOOST_CHECK_EQUAL(req.uri, "/first");
+
+  req.reset();
+  parser.reset();
+  p = parse(parser, req, data.data() + first.size(), data.data() + data.size());
+  BOOST_CHECK(p.complete());
+  BOOST_CHECK_EQUAL(p.consumed, second.size());
+  BOOST_CHECK_EQUAL(req.uri, "/second");
+}
+
+BOOST_AUTO_TEST_CASE(malformed_requests_are_rejected)
+{
+  const char* const malformed[] =
+  {
+    "GET /\r\n\r\n",
+    "GET / HTTX/1.1\r\n\r\n",
+    "GET / HTTP/a.1\r\n\r\n",
+    "G(T / HTTP/1.1\r\n\r\n",
+    "GET / HTTP/1.1\r\nBad(Name: x\r\n\r\n",
+    0
+  };
+  for (const char* const* m = malformed; *m; ++m)
+  {
+    request_parser parser;
+    request_view req;
+    BOOST_CHECK_MESSAGE(parse(parser, req, *m).failed(), *m);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(bodies_are_framed_by_content_length)
+{
+  // Short bodies, bodies of any method and a request following the body.
+  const char* const methods[] = { "POST", "PUT", "DELETE", 0 };
+  for (const char* const* m = methods; *m; ++m)
+  {
+    request_parser parser;
+    request_view req;
+    std::string first = std::string(*m) + " /a HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello";
+    parsed p = parse_through_body(parser, req, first + "GET /b HTTP/1.1\r\n\r\n");
+    BOOST_CHECK_MESSAGE(p.complete(), *m);
+    BOOST_CHECK_EQUAL(p.consumed, first.size());
+    BOOST_CHECK_EQUAL(req.post, "hello");
+  }
+}
+
+BOOST_AUTO_TEST_CASE(bodies_split_across_reads)
+{
+  request_parser parser;
+  request_view req;
+  std::string head = "POST /a HTTP/1.1\r\nContent-Length: 10\r\n\r\n";
+  parsed p = parse(parser, req, head);
+  BOOST_CHECK(boost::indeterminate(p.result));
+  BOOST_CHECK(parser.at_body_start());
+  BOOST_CHECK_EQUAL(parser.body_remaining(), 10u);
+  p = parse(parser, req, "0123");
+  BOOST_CHECK(boost::indeterminate(p.result));
+  BOOST_CHECK_EQUAL(parser.body_remaining(), 6u);
+  p = parse(parser, req, "456789GET");
+  BOOST_CHECK(p.complete());
+  BOOST_CHECK_EQUAL(p.consumed, 6u);
+  BOOST_CHECK_EQUAL(req.post, "0123456789");
+}
+
+BOOST_AUTO_TEST_CASE(requests_without_a_length_have_no_body)
+{
+  const char* const requests[] =
+  {
+    "POST /a HTTP/1.1\r\n\r\n",
+    "POST /a HTTP/1.1\r\nContent-Length: 0\r\n\r\n",
+    0
+  };
+  for (const char* const* r = requests; *r; ++r)
+  {
+    request_parser parser;
+    request_view req;
+    parsed p = parse(parser, req, *r);
+    BOOST_CHECK_MESSAGE(p.complete(), *r);
+    BOOST_CHECK(req.post.empty());
+  }
+}
+
+BOOST_AUTO_TEST_CASE(form_bodies_are_parsed_into_parameters)
+{
+  request_parser parser;
+  request_view req;
+  std::string body = "a=1&b=two";
+  parsed p = parse_through_body(parser, req, "POST /f HTTP/1.1\r\n"
+      "Content-Type: application/x-www-form-urlencoded\r\n"
+      "Content-Length: 9\r\n\r\n" + body);
+  BOOST_CHECK(p.complete());
+  BOOST_CHECK_EQUAL(req.post, body);
+  BOOST_CHECK_EQUAL(req.parameters.find("a")->second, "1");
+  BOOST_CHECK_EQUAL(req.parameters.find("b")->second, "two");
+}
+
+BOOST_AUTO_TEST_CASE(unframeable_bodies_are_rejected)
+{
+  const char* const unframeable[] =
+  {
+    "POST / HTTP/1.1\r\nContent-Length: 1x\r\n\r\n",
+    "POST / HTTP/1.1\r\nContent-Length: \r\n\r\n",
+    "POST / HTTP/1.1\r\nContent-Length: 1\r\nContent-Length: 1\r\n\r\n",
+    "POST / HTTP/1.1\r\nContent-Length: 99999999999999999999999\r\n\r\n",
+    0
+  };
+  for (const char* const* u = unframeable; *u; ++u)
+  {
+    request_parser parser;
+    request_view req;
+    BOOST_CHECK_MESSAGE(parse(parser, req, *u).failed(), *u);
+    BOOST_CHECK(!parser.unsupported());
+  }
+}
+
+BOOST_AUTO_TEST_CASE(transfer_codings_are_unsupported)
+{
+  request_parser parser;
+  request_view req;
+  BOOST_CHECK(parse(parser, req, "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n").failed());
+  BOOST_CHECK(parser.unsupported());
+  parser.reset();
+  BOOST_CHECK(!parser.unsupported());
+}
+
+BOOST_AUTO_TEST_CASE(well_known_headers_are_identified_ignoring_case)
+{
+  const char* const names[] =
+  {
+    0, "Accept", "Accept-Encoding", "Authorization", "Connection",
+    "Content-Length", "Content-Type", "Cookie", "Expect", "Host",
+    "If-Modified-Since", "If-None-Match", "If-Range", "Range",
+    "Transfer-Encoding", "Upgrade", "User-Agent"
+  };
+  for (int id = accept_header; id != header_id_count; ++id)
+  {
+    std::string name = names[id];
+    BOOST_CHECK_EQUAL(identify_header(name), id);
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    BOOST_CHECK_EQUAL(identify_header(name), id);
+    std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+    BOOST_CHECK_EQUAL(identify_header(name), id);
+  }
+  BOOST_CHECK_EQUAL(identify_header("Accept-Language"), unknown_header);
+  BOOST_CHECK_EQUAL(identify_header("Hosts"), unknown_header);
+  BOOST_CHECK_EQUAL(identify_header(""), unknown_header);
+}
+
+BOOST_AUTO_TEST_CASE(header_lookup_ignores_case)
+{
+  request_parser parser;
+  request_view req;
+  std::string data = "POST /a HTTP/1.1\r\nhost: localhost\r\nCONNECTION: close\r\n"
+    "x-custom: 1\r\ncontent-length: 30\r\n\r\n";
+  parsed p = parse(parser, req, data);
+  BOOST_CHECK(boost::indeterminate(p.result));
+  BOOST_CHECK(parser.at_body_start());
+  BOOST_CHECK_EQUAL(req.content_length, 30u);
+  BOOST_CHECK_EQUAL(req.headers.value(host_header), "localhost");
+  BOOST_CHECK_EQUAL(req.headers.value(connection_header), "close");
+  BOOST_CHECK_EQUAL(req.headers.find("Connection")->second, "close");
+  BOOST_CHECK_EQUAL(req.headers.find("X-Custom")->second, "1");
+  BOOST_CHECK(req.headers.find(accept_header) == req.headers.end());
+  BOOST_CHECK(req.headers.value(accept_header).empty());
+}
+
+BOOST_AUTO_TEST_CASE(repeated_content_length_is_rejected)
+{
+  request_parser parser;
+  request_view req;
+  std::string data = "POST /a HTTP/1.1\r\nContent-Length: 30\r\ncontent-length: 30\r\n";
+  parsed p = parse(parser, req, data);
+  BOOST_CHECK(p.failed());
+  BOOST_CHECK(p.consumed < data.size());
+}
+
+BOOST_AUTO_TEST_CASE(splitting_a_request_anywhere_changes_nothing)
+{
+  // Runs of ordinary characters are taken in one go, a split must not end
+  // or corrupt one.
+  std::string data = "GET /some/longer/path?first=1&second=two&third=%20x HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) Gecko/20100101 Firefox/118.0\r\n"
+    "Accept: text/html,application/xhtml+xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "X-Tilde-Pipe: a~b|c\r\n"
+    "Content-Length: 11\r\n\r\nhello world";
+  request_parser whole_parser;
+  request_view whole;
+  BOOST_REQUIRE(parse_through_body(whole_parser, whole, data).complete());
+
+  for (std::size_t split = 1; split < data.size(); ++split)
+  {
+    request_parser parser;
+    request_view req;
+    parsed p = parse_through_body(parser, req, data.data(), data.data() + split);
+    std::size_t consumed = p.consumed;
+    if (!p.complete())
+    {
+      BOOST_REQUIRE(boost::indeterminate(p.result));
+      p = parse_through_body(parser, req, data.data() + consumed, data.data() + data.size());
+      consumed += p.consumed;
+    }
+    BOOST_REQUIRE_MESSAGE(p.complete(), "split at " << split);
+    BOOST_CHECK_EQUAL(consumed, data.size());
+    BOOST_CHECK_EQUAL(req.method, whole.method);
+    BOOST_CHECK_EQUAL(req.uri, whole.uri);
+    BOOST_CHECK(std::equal(req.headers.begin(), req.headers.end(), whole.headers.begin()));
+    BOOST_CHECK(std::equal(req.parameters.begin(), req.parameters.end(), whole.parameters.begin()));
+    BOOST_CHECK_EQUAL(req.post, whole.post);
+  }
+  BOOST_CHECK_EQUAL(whole.headers.find("X-Tilde-Pipe")->second, "a~b|c");
+  BOOST_CHECK_EQUAL(whole.parameters.find("second")->second, "two");
+}
+
+BOOST_AUTO_TEST_CASE(handlers_get_a_request_owning_its_bytes)
+{
+  request_parser parser;
+  request_view view;
+  std::string data = "POST /form?q=1 HTTP/1.1\r\nHost: localhost\r\nX-Twice: a\r\n"
+    "X-Twice: b\r\nContent-Type: application/x-www-form-urlencoded\r\n"
+    "Content-Length: 7\r\n\r\nf=v&g=w";
+  BOOST_REQUIRE(parse_through_body(parser, view, data).complete());
+
+  request req(view);
+  data.assign(data.size(), 'x');
+  view.reset();
+  BOOST_CHECK_EQUAL(req.method, "POST");
+  BOOST_CHECK_EQUAL(req.uri, "/form?q=1");
+  BOOST_CHECK_EQUAL(req.http_version_minor, 1);
+  BOOST_CHECK_EQUAL(req.headers.count("X-Twice"), 2u);
+  BOOST_CHECK_EQUAL(req.headers.lower_bound("X-Twice")->second, "a");
+  BOOST_CHECK_EQUAL(req.headers.find("Host")->second, "localhost");
+  BOOST_CHECK_EQUAL(req.parameters.size(), 3u);
+  BOOST_CHECK_EQUAL(req.parameters.find("q")->second, "1");
+  BOOST_CHECK_EQUAL(req.parameters.find("g")->second, "w");
+  BOOST_CHECK_EQUAL(req.post, "f=v&g=w");
+}
+
+BOOST_AUTO_TEST_CASE(folded_header_lines_continue_the_value)
+{
+  std::string data = "GET / HTTP/1.1\r\nX-Long: first\r\n  second\r\n\tthird\r\n"
+    "Host: localhost\r\n\r\n";
+  for (std::size_t split = 1; split <= data.size(); ++split)
+  {
+    request_parser parser;
+    request_view req;
+    parsed p = parse(parser, req, data.data(), data.data() + split);
+    if (split < data.size())
+    {
+      BOOST_REQUIRE(boost::indeterminate(p.result));
+      p = parse(parser, req, data.data() + split, data.data() + data.size());
+    }
+    BOOST_REQUIRE_MESSAGE(p.complete(), "split at " << split);
+    BOOST_CHECK_EQUAL(req.headers.size(), 2u);
+    BOOST_CHECK_EQUAL(req.headers.find("X-Long")->second, "firstsecondthird");
+    BOOST_CHECK_EQUAL(req.headers.value(host_header), "localhost");
+  }
+
+  // There is nothing to continue before the first header.
+  request_parser parser;
+  request_view req;
+  BOOST_CHECK(parse(parser, req, "GET / HTTP/1.1\r\n folded\r\n\r\n").failed());
+}
+
+BOOST_AUTO_TEST_CASE(parameters_need_an_equals_sign)
+{
+  request_parser parser;
+  request_view req;
+  std::string data = "POST /p?x&y=1&z HTTP/1.1\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: 9\r\n\r\n"
+    "a&b=2&c=c";
+  BOOST_REQUIRE(parse_through_body(parser, req, data).complete());
+  BOOST_CHECK_EQUAL(req.uri, "/p?x&y=1&z");
+  BOOST_CHECK_EQUAL(req.parameters.size(), 3u);
+  BOOST_CHECK_EQUAL(req.parameters.find("y")->second, "1");
+  BOOST_CHECK_EQUAL(req.parameters.find("b")->second, "2");
+  BOOST_CHECK_EQUAL(req.parameters.find("c")->second, "c");
+  BOOST_CHECK(req.parameters.find("x") == req.parameters.end());
+
+  // Nor is a name at the end of a form body.
+  request_parser form_parser;
+  request_view form;
+  data = "POST /p HTTP/1.1\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: 5\r\n\r\n"
+    "a=1&b";
+  BOOST_REQUIRE(parse_through_body(form_parser, form, data).complete());
+  BOOST_CHECK_EQUAL(form.parameters.size(), 1u);
+  BOOST_CHECK_EQUAL(form.parameters.find("a")->second, "1");
+}
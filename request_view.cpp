@@ -0,0 +1,68 @@
+//
+// request_view.cpp
+// ~~~~~~~~~~~~~~~~
+//
+
+#include "request_view.hpp"
+
+namespace http {
+namespace server {
+
+namespace {
+
+/// Move a view of bytes at from to the same bytes at to, if it is one.
+void relocate_view(boost::string_ref& view, const char* from,
+    std::size_t size, const char* to)
+{
+  if (!view.empty() && view.data() >= from && view.data() < from + size)
+    view = boost::string_ref(to + (view.data() - from), view.size());
+}
+
+} // namespace
+
+void request_view::reset()
+{
+  // The body is sized to each request, its capacity is not carried over to
+  // the next request or, through the connection pool, the next client.
+  method.clear();
+  std::string().swap(post);
+  uri.clear();
+  http_version_major = 0;
+  http_version_minor = 0;
+  content_length = 0;
+  headers.clear();
+  parameters.clear();
+  post_file.reset();
+  body.reset();
+  folded_values_.clear();
+}
+
+void request_view::relocate(const char* from, std::size_t size, const char* to)
+{
+  relocate_view(method, from, size, to);
+  relocate_view(uri, from, size, to);
+  for (request_fields::container_type::iterator i = headers.fields_.begin();
+      i != headers.fields_.end(); ++i)
+  {
+    relocate_view(i->first, from, size, to);
+    relocate_view(i->second, from, size, to);
+  }
+  for (request_fields::container_type::iterator i = parameters.fields_.begin();
+      i != parameters.fields_.end(); ++i)
+  {
+    relocate_view(i->first, from, size, to);
+    relocate_view(i->second, from, size, to);
+  }
+}
+
+void request_view::fold_back(const char* begin, const char* end)
+{
+  boost::string_ref& value = headers.back().second;
+  if (folded_values_.empty() || value.data() != folded_values_.back().data())
+    folded_values_.push_back(value.to_string());
+  folded_values_.back().append(begin, end);
+  value = folded_values_.back();
+}
+
+} // namespace server
+} // namespace http
@@ -0,0 +1,198 @@
+//
+// request_view.hpp
+// ~~~~~~~~~~~~~~~~
+//
+// A request as parsed, viewing the bytes it was read into.
+//
+
+#ifndef HTTP_SERVER_REQUEST_VIEW_HPP
+#define HTTP_SERVER_REQUEST_VIEW_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <utility>
+#include <boost/container/small_vector.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/utility/string_ref.hpp>
+#include "file_body.hpp"
+#include "header_id.hpp"
+#include "request_body.hpp"
+
+namespace http {
+namespace server {
+
+/// Name and value pairs of a request, headers or parameters, in the order
+/// they were received. Names and values view the bytes of the request, and
+/// a typical request fits the inline storage without allocating.
+class request_fields
+{
+public:
+  typedef std::pair<boost::string_ref, boost::string_ref> value_type;
+  typedef boost::container::small_vector<value_type, 16> container_type;
+  typedef container_type::const_iterator const_iterator;
+  typedef const_iterator iterator;
+
+  const_iterator begin() const { return fields_.begin(); }
+  const_iterator end() const { return fields_.end(); }
+  bool empty() const { return fields_.empty(); }
+  std::size_t size() const { return fields_.size(); }
+
+  /// The first field with the given name, or end if there is none.
+  const_iterator find(boost::string_ref name) const
+  {
+    const_iterator i = fields_.begin();
+    while (i != fields_.end() && i->first != name)
+      ++i;
+    return i;
+  }
+
+  /// Number of fields with the given name.
+  std::size_t count(boost::string_ref name) const
+  {
+    std::size_t n = 0;
+    for (const_iterator i = fields_.begin(); i != fields_.end(); ++i)
+      n += i->first == name;
+    return n;
+  }
+
+  /// Add a field at the end.
+  void push_back(const value_type& field) { fields_.push_back(field); }
+
+  /// Remove the last field added.
+  void pop_back() { fields_.pop_back(); }
+
+  /// The last field added, for the parser to extend.
+  value_type& back() { return fields_.back(); }
+
+  /// Remove every field, keeping the storage.
+  void clear() { fields_.clear(); }
+
+protected:
+  friend struct request_view;
+
+  container_type fields_;
+};
+
+/// The headers of a request. Names are compared ignoring case, and those
+/// with a header_id are found in constant time.
+class request_headers
+  : public request_fields
+{
+public:
+  request_headers() { clear(); }
+
+  /// The first header with a well-known name, or end if there is none.
+  const_iterator find(header_id id) const
+  {
+    return known_[id] != 0 ? fields_.begin() + (known_[id] - 1) : end();
+  }
+
+  /// The first header with the given name, or end if there is none.
+  const_iterator find(boost::string_ref name) const
+  {
+    header_id id = identify_header(name);
+    if (id != unknown_header)
+      return find(id);
+    const_iterator i = fields_.begin();
+    while (i != fields_.end() && !header_name_equals(i->first, name))
+      ++i;
+    return i;
+  }
+
+  /// The value of the first header with a well-known name, empty if there
+  /// is none.
+  boost::string_ref value(header_id id) const
+  {
+    return known_[id] != 0 ? fields_[known_[id] - 1].second : boost::string_ref();
+  }
+
+  /// Number of headers with the given name.
+  std::size_t count(boost::string_ref name) const
+  {
+    std::size_t n = 0;
+    for (const_iterator i = fields_.begin(); i != fields_.end(); ++i)
+      n += header_name_equals(i->first, name);
+    return n;
+  }
+
+  /// Record the well-known name of the last header added, once its name is
+  /// complete. Returns false if an earlier header had the same name.
+  bool identify_back(header_id id)
+  {
+    if (id == unknown_header)
+      return true;
+    if (known_[id] != 0)
+      return false;
+    known_[id] = fields_.size();
+    return true;
+  }
+
+  /// Remove every header, keeping the storage.
+  void clear()
+  {
+    fields_.clear();
+    std::fill(known_, known_ + header_id_count, 0);
+  }
+
+private:
+  /// One more than the index of the first header with each id, 0 if none.
+  std::size_t known_[header_id_count];
+};
+
+/// A request as the parser leaves it.
+///
+/// The method, URI, headers and query parameters view the connection's read
+/// buffer, which keeps the bytes of the request in place until it is reset.
+/// Form parameters view post. The server looks at the request through these
+/// views, registered handlers get a request converted from it.
+struct request_view
+  : private boost::noncopyable
+{
+  boost::string_ref method;
+  std::string post;
+  boost::string_ref uri;
+  int http_version_major;
+  int http_version_minor;
+
+  request_headers headers;
+
+  request_fields parameters;
+
+  /// The value of the Content-Length header, 0 if there is none.
+  std::size_t content_length;
+
+  /// The body when it was too large to hold in memory, in an unlinked
+  /// temporary file whose length is that of the body. Null otherwise, the
+  /// body is then in post.
+  file_body_ptr post_file;
+
+  /// The body as it arrives, for handlers streaming it. Null otherwise, the
+  /// body is then collected in post.
+  request_body_ptr body;
+
+  request_view() : http_version_major(0), http_version_minor(0), content_length(0) { ; }
+
+  /// Clear the request so it can be reused for the next request on a
+  /// persistent connection. Storage is retained, except that of post.
+  void reset();
+
+  /// Point the views of bytes at from, size bytes long, at the same bytes
+  /// moved to to.
+  void relocate(const char* from, std::size_t size, const char* to);
+
+  /// Append bytes from a folded line to the value of the last header. The
+  /// value is then no longer one run of the buffer, the request holds it.
+  void fold_back(const char* begin, const char* end);
+
+private:
+  /// Values of headers continued on folded lines. A deque does not move its
+  /// strings as it grows.
+  std::deque<std::string> folded_values_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_SERVER_REQUEST_VIEW_HPP
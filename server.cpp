@@ -9,11 +9,14 @@
 //
 
 #include "server.hpp"
+#include "byte_set.hpp"
 #include <boost/thread/thread.hpp>
 #include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/shared_ptr.hpp>
 #include <vector>
 #include <memory>
+#include <algorithm>
 
 namespace http
 {
@@ -76,11 +79,76 @@ public:
     response << "<html><body>" << std::endl;
     response << "<br><h1>General Server Statistics</h1>" << std::endl;
     response << "<br>Thread Pool Size: " << server.thread_pool_size_ << "</br>" << std::endl;
-    response << "<br>Max Connections: " << server.acceptor_.max_connections << "</br>" << std::endl;
-    response << "<br>Messages - Do not route: " << server.acceptor_.message_do_not_route << "</br>" << std::endl;
-    response << "<br>Messages - End of Record: " << server.acceptor_.message_end_of_record << "</br>" << std::endl;
-    response << "<br>Messages - Out of Band: " << server.acceptor_.message_out_of_band << "</br>" << std::endl;
-    response << "<br>Messages - Peek: " << server.acceptor_.message_peek << "</br>" << std::endl;
+    response << "<br>I/O Mode: " << (server.options_.sharded ? "sharded" : "shared") << "</br>" << std::endl;
+    response << "<br>Parser Scan: " << byte_set::implementation() << "</br>" << std::endl;
+    response << "<br>I/O Shards: " << server.shards_.size() << "</br>" << std::endl;
+    response << "<br>Max Connections: " << boost::asio::socket_base::max_connections << "</br>" << std::endl;
+    response << "<br>Pending Accepts: " << server.options_.pending_accepts << "</br>" << std::endl;
+    response << "<br>Connections Accepted: " << server.stats_.connections_accepted << "</br>" << std::endl;
+    response << "<br>Accept Wakeups: " << server.stats_.accept_wakeups << "</br>" << std::endl;
+    response << "<br>Max Accepts per Wakeup: " << server.stats_.max_accepts_per_wakeup << "</br>" << std::endl;
+    response << "<br>Connection Pool Size: " << server.options_.connection_pool_size << "</br>" << std::endl;
+    response << "<br>Connection Pool Hits: " << server.stats_.connection_pool_hits << "</br>" << std::endl;
+    response << "<br>Connection Pool Misses: " << server.stats_.connection_pool_misses << "</br>" << std::endl;
+    std::size_t idle = 0;
+    for (const server::shard_ptr& s : server.shards_)
+    {
+      idle += s->pool->idle_count();
+    }
+    response << "<br>Connection Pool Idle: " << idle << "</br>" << std::endl;
+    response << "<br>Handler Allocations: " << server.stats_.handler_allocations << "</br>" << std::endl;
+    response << "<br>Handler Heap Allocations: " << server.stats_.handler_heap_allocations << "</br>" << std::endl;
+    std::size_t deadlines = 0;
+    for (const server::shard_ptr& s : server.shards_)
+    {
+      deadlines += s->wheel->size();
+    }
+    response << "<br>Armed Deadlines: " << deadlines << "</br>" << std::endl;
+    response << "<br>Idle Timeouts: " << server.stats_.idle_timeouts << "</br>" << std::endl;
+    response << "<br>Header Timeouts: " << server.stats_.header_timeouts << "</br>" << std::endl;
+    response << "<br>Body Timeouts: " << server.stats_.body_timeouts << "</br>" << std::endl;
+    response << "<br>Write Timeouts: " << server.stats_.write_timeouts << "</br>" << std::endl;
+    response << "<br>Active Connections: " << server.stats_.active_connections << "</br>" << std::endl;
+    response << "<br>Connection Limit: " << server.options_.max_connections << "</br>" << std::endl;
+    response << "<br>Connections Shed: " << server.stats_.connections_shed << "</br>" << std::endl;
+    response << "<br>Requests in Flight: " << server.stats_.requests_in_flight << "</br>" << std::endl;
+    response << "<br>Requests in Flight Limit: " << server.options_.max_requests_in_flight << "</br>" << std::endl;
+    response << "<br>Requests Shed: " << server.stats_.requests_shed << "</br>" << std::endl;
+    response << "<br>File Cache Bytes: " << server.request_handler_.file_cache_.size() << " of " << server.options_.file_cache_bytes << "</br>" << std::endl;
+    response << "<br>File Cache Hits: " << server.stats_.file_cache_hits << "</br>" << std::endl;
+    response << "<br>File Cache Misses: " << server.stats_.file_cache_misses << "</br>" << std::endl;
+    response << "<br>File Cache Evictions: " << server.stats_.file_cache_evictions << "</br>" << std::endl;
+    response << "<br>File Cache Invalidations: " << server.stats_.file_cache_invalidations << "</br>" << std::endl;
+    response << "<br>Partial Replies: " << server.stats_.partial_replies << "</br>" << std::endl;
+    response << "<br>Unsatisfiable Ranges: " << server.stats_.unsatisfiable_ranges << "</br>" << std::endl;
+    response << "<br>Compressed Replies: " << server.stats_.compressed_replies << "</br>" << std::endl;
+    response << "<br>Streamed Replies: " << server.stats_.streamed_replies << "</br>" << std::endl;
+    response << "<br>Streamed Request Bodies: " << server.stats_.streamed_request_bodies << "</br>" << std::endl;
+    response << "<br>Spilled Request Bodies: " << server.stats_.spilled_request_bodies << "</br>" << std::endl;
+    response << "<br>Request Body Memory: " << server.stats_.request_body_bytes << " of " << server.options_.max_body_memory << "</br>" << std::endl;
+    response << "<br>Refused Request Bodies: " << server.stats_.refused_bodies << "</br>" << std::endl;
+    response << "<br>Read Buffer Memory: " << server.stats_.read_buffer_bytes << "</br>" << std::endl;
+    std::size_t idle_connections = server.stats_.idle_connections;
+    response << "<br>Idle Connections: " << idle_connections << "</br>" << std::endl;
+    response << "<br>Read Buffer Memory per Idle Connection: " << (idle_connections == 0 ? 0 : server.stats_.idle_read_buffer_bytes / idle_connections) << "</br>" << std::endl;
+    response << "<br>Oversized Request Heads: " << server.stats_.oversized_heads << "</br>" << std::endl;
+    response << "<br>Deferred Replies: " << server.stats_.deferred_replies << "</br>" << std::endl;
+    response << "<br>Handler Timeouts: " << server.stats_.handler_timeouts << "</br>" << std::endl;
+    response << "<br>Worker Threads: " << server.options_.worker_threads << "</br>" << std::endl;
+    response << "<br>Worker Queue Depth: " << server.workers_.queue_depth() << " of " << server.options_.worker_queue_limit << "</br>" << std::endl;
+    response << "<br>Worker Tasks: " << server.stats_.worker_tasks << "</br>" << std::endl;
+    response << "<br>Worker Rejected: " << server.stats_.worker_rejected << "</br>" << std::endl;
+    std::size_t tasks = server.stats_.worker_tasks;
+    response << "<br>Worker Average Wait (us): " << (tasks == 0 ? 0 : server.stats_.worker_wait_us / tasks) << "</br>" << std::endl;
+    response << "<br>Worker Longest Wait (us): " << server.stats_.worker_max_wait_us << "</br>" << std::endl;
+    response << "<br>Coroutines Started: " << server.stats_.coroutines_started << "</br>" << std::endl;
+    response << "<br>Coroutines Active: " << server.stats_.coroutines_active << "</br>" << std::endl;
+    response << "<br>Compression Bytes: " << server.stats_.compression_bytes_in << " to " << server.stats_.compression_bytes_out << "</br>" << std::endl;
+    response << "<br>Max Keep-Alive Requests: " << server.options_.max_keep_alive_requests << "</br>" << std::endl;
+    response << "<br>Messages - Do not route: " << boost::asio::socket_base::message_do_not_route << "</br>" << std::endl;
+    response << "<br>Messages - End of Record: " << boost::asio::socket_base::message_end_of_record << "</br>" << std::endl;
+    response << "<br>Messages - Out of Band: " << boost::asio::socket_base::message_out_of_band << "</br>" << std::endl;
+    response << "<br>Messages - Peek: " << boost::asio::socket_base::message_peek << "</br>" << std::endl;
     /**
      * // TODO:  Get a string representation of the signals this service is handling
     for(auto s : server.signals_) 
@@ -108,13 +176,24 @@ private:
   const http::server::server& server;
 };
 
+namespace
+{
+
+/// Socket option allowing several acceptors to bind the same endpoint, with
+/// the kernel spreading incoming connections between them.
+typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+
+} // namespace
+
 server::server(const std::string& address, const std::string& port,
-               const std::string& doc_root, std::size_t thread_pool_size)
+               const std::string& doc_root, std::size_t thread_pool_size,
+               const server_options& options)
 : thread_pool_size_(thread_pool_size),
-signals_(io_service_),
-acceptor_(io_service_),
-new_connection_(),
-request_handler_(doc_root)
+options_(options),
+shards_(create_shards(options.sharded ? thread_pool_size : 1, options.timer_tick_ms)),
+signals_(shards_.front()->io_service),
+workers_(options_.worker_threads, options_.worker_queue_limit, stats_),
+request_handler_(doc_root, options_, stats_, workers_)
 {
     // Register to handle the signals that indicate when the server should exit.
     // It is safe to register for the same signal multiple times in a program,
@@ -126,18 +205,40 @@ request_handler_(doc_root)
 #endif // defined(SIGQUIT)
     signals_.async_wait(boost::bind(&server::handle_stop, this));
 
-    // Open the acceptor with the option to reuse the address (i.e. SO_REUSEADDR).
-    boost::asio::ip::tcp::resolver resolver(io_service_);
+    // The reply for shed connections never changes, build it once.
+    reply overload = reply::stock_reply(reply::service_unavailable);
+    overload.headers.insert(std::make_pair(std::string("Retry-After"), boost::lexical_cast<std::string>(options_.retry_after_seconds)));
+    overload.headers.insert(std::make_pair(std::string("Connection"), std::string("close")));
+    for (const boost::asio::const_buffer& b : overload.to_buffers())
+    {
+        overload_response_.append(boost::asio::buffer_cast<const char*>(b), boost::asio::buffer_size(b));
+    }
+
+    boost::asio::ip::tcp::resolver resolver(shards_.front()->io_service);
     boost::asio::ip::tcp::resolver::query query(address, port);
     boost::asio::ip::tcp::endpoint endpoint = *resolver.resolve(query);
-    acceptor_.open(endpoint.protocol());
-    acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
-    acceptor_.bind(endpoint);
-    acceptor_.listen();
+
+    // A connection only needs a strand when its io_service is run by more
+    // than one thread.
+    bool use_strand = !options_.sharded && thread_pool_size_ > 1;
+    for (const shard_ptr& s : shards_)
+    {
+        open_acceptor(*s, endpoint);
+        s->pool.reset(new connection_pool(s->io_service, request_handler_, options_, use_strand, stats_, s->wheel));
+        s->wheel->start();
+    }
+
+    request_handler_.start(shards_.front()->io_service);
 
     register_handler(std::shared_ptr<registered_handler>(new echo_handler()));    
     register_handler(std::shared_ptr<registered_handler>(new status_handler(*this)));
-    start_accept();
+    for (const shard_ptr& s : shards_)
+    {
+        for (std::size_t i = 0; i < std::max<std::size_t>(options_.pending_accepts, 1); ++i)
+        {
+            start_accept(*s, create_connection(*s));
+        }
+    }
 }
 
 server::~server()
@@ -145,6 +246,34 @@ server::~server()
     stop();
 }
 
+std::vector<server::shard_ptr> server::create_shards(std::size_t count,
+                                                    std::size_t timer_tick_ms)
+{
+    std::vector<shard_ptr> shards;
+    for (std::size_t i = 0; i < std::max<std::size_t>(count, 1); ++i)
+    {
+        shards.push_back(shard_ptr(new shard(timer_tick_ms)));
+    }
+    return shards;
+}
+
+void server::open_acceptor(shard& s, const boost::asio::ip::tcp::endpoint& endpoint)
+{
+    // Open the acceptor with the option to reuse the address (i.e. SO_REUSEADDR).
+    // Sharded acceptors all bind the same endpoint using SO_REUSEPORT.
+    s.acceptor.open(endpoint.protocol());
+    s.acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+    if (options_.sharded)
+    {
+        s.acceptor.set_option(reuse_port(true));
+    }
+    s.acceptor.bind(endpoint);
+    s.acceptor.listen();
+
+    // Non-blocking so the backlog can be drained after each accept completes.
+    s.acceptor.non_blocking(true);
+}
+
 void server::register_handler(std::shared_ptr<registered_handler> handler)
 {
     request_handler_.register_handler(handler);
@@ -152,12 +281,16 @@ void server::register_handler(std::shared_ptr<registered_handler> handler)
 
 void server::run()
 {
+    workers_.start();
+
     std::vector<boost::shared_ptr<boost::thread> > threads;
     {
-        // Create a pool of threads to run all of the io_services.
+        // Create a pool of threads to run all of the io_services. When
+        // sharded each thread runs its own io_service.
         for (std::size_t i = 0; i < thread_pool_size_; ++i)
         {
-            boost::shared_ptr<boost::thread> thread(new boost::thread(boost::bind(&boost::asio::io_service::run, &io_service_)));
+            shard& s = *shards_[i % shards_.size()];
+            boost::shared_ptr<boost::thread> thread(new boost::thread(boost::bind(&boost::asio::io_service::run, &s.io_service)));
             threads.push_back(thread);
         }
     }
@@ -165,6 +298,9 @@ void server::run()
     // Wait for all threads in the pool to exit.
     for (std::size_t i = 0; i < threads.size(); ++i)
         threads[i]->join();
+
+    workers_.stop();
+    workers_.join();
 }
 
 void server::stop()
@@ -172,29 +308,135 @@ void server::stop()
     handle_stop();
 }
 
-void server::start_accept()
+connection_ptr server::create_connection(shard& s)
+{
+    return s.pool->acquire();
+}
+
+bool server::at_connection_limit() const
+{
+    return options_.max_connections != 0
+            && stats_.active_connections >= options_.max_connections;
+}
+
+void server::admit(const connection_ptr& new_connection)
+{
+    // While paused, accepts already in flight are let through rather than
+    // turned away.
+    if (options_.connection_overload_action != server_options::overload_pause_accept
+            && at_connection_limit())
+    {
+        shed(new_connection);
+    }
+    else
+    {
+        new_connection->start();
+    }
+}
+
+void server::shed(const connection_ptr& new_connection)
+{
+    ++stats_.connections_shed;
+    boost::asio::ip::tcp::socket& socket = new_connection->socket();
+    boost::system::error_code ignored_ec;
+    if (options_.connection_overload_action == server_options::overload_reply)
+    {
+        // Best effort, the reply fits in an empty send buffer. A request
+        // already received is drained so closing does not reset the
+        // connection before the client reads the reply. The drain is
+        // bounded, a client that keeps sending must not hold the accept
+        // path.
+        socket.non_blocking(true, ignored_ec);
+        socket.write_some(boost::asio::buffer(overload_response_), ignored_ec);
+        char discard[512];
+        std::size_t drained = 0;
+        std::size_t n;
+        while (drained < 4 * sizeof(discard)
+                && (n = socket.read_some(boost::asio::buffer(discard), ignored_ec)) > 0)
+        {
+            drained += n;
+        }
+        socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored_ec);
+    }
+    socket.close(ignored_ec);
+}
+
+void server::start_accept(shard& s, const connection_ptr& new_connection)
 {
-    new_connection_.reset(new connection(io_service_, request_handler_));
-    acceptor_.async_accept(new_connection_->socket(),
-                           boost::bind(&server::handle_accept, this,
-                                       boost::asio::placeholders::error));
+    if (options_.connection_overload_action == server_options::overload_pause_accept
+            && at_connection_limit())
+    {
+        // Leave new clients in the listen backlog and look again next tick.
+        s.parked.push_back(new_connection);
+        if (s.parked.size() == 1)
+        {
+            s.accept_timer.expires_from_now(std::chrono::milliseconds(options_.timer_tick_ms));
+            s.accept_timer.async_wait(s.accept_strand.wrap(
+                    boost::bind(&server::handle_accept_timer, this, boost::ref(s),
+                                boost::asio::placeholders::error)));
+        }
+        return;
+    }
+
+    s.acceptor.async_accept(new_connection->socket(),
+                           s.accept_strand.wrap(
+                               boost::bind(&server::handle_accept, this, boost::ref(s),
+                                           new_connection, boost::asio::placeholders::error)));
+}
+
+void server::handle_accept_timer(shard& s, const boost::system::error_code& e)
+{
+    if (e == boost::asio::error::operation_aborted)
+        return;
+
+    std::vector<connection_ptr> parked;
+    parked.swap(s.parked);
+    for (const connection_ptr& c : parked)
+    {
+        start_accept(s, c);
+    }
 }
 
-void server::handle_accept(const boost::system::error_code & e)
+void server::handle_accept(shard& s, connection_ptr new_connection,
+                           const boost::system::error_code & e)
 {
     if (!e)
     {
-        new_connection_->start();
+        admit(new_connection);
+
+        // Take whatever else is already queued rather than waiting for another
+        // completion per connection.
+        std::size_t accepted = 1;
+        boost::system::error_code ec;
+        new_connection = create_connection(s);
+        while (accepted < options_.max_accepts_per_wakeup
+                && !(options_.connection_overload_action == server_options::overload_pause_accept
+                     && at_connection_limit())
+                && !s.acceptor.accept(new_connection->socket(), ec))
+        {
+            admit(new_connection);
+            new_connection = create_connection(s);
+            ++accepted;
+        }
+        stats_.record_accept_wakeup(accepted);
+    }
+    else
+    {
+        new_connection = create_connection(s);
     }
 
-    start_accept();
+    start_accept(s, new_connection);
 }
 
 void server::handle_stop()
 {
-    if (io_service_.stopped() == false)
+    workers_.stop();
+    for (const shard_ptr& s : shards_)
     {
-        io_service_.stop();
+        if (s->io_service.stopped() == false)
+        {
+            s->io_service.stop();
+        }
     }
 }
 
@@ -12,12 +12,18 @@
 #define HTTP_SERVER_SERVER_HPP
 
 #include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <string>
+#include <vector>
 #include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
 #include "connection.hpp"
+#include "connection_pool.hpp"
 #include "request_handler.hpp"
 #include "registered_handler.h"
+#include "server_options.hpp"
+#include "server_stats.hpp"
+#include "worker_pool.hpp"
 
 namespace http {
 namespace server {
@@ -31,7 +37,8 @@ public:
   /// Construct the server to listen on the specified TCP address and port, and
   /// serve up files from the given directory.
   explicit server(const std::string& address, const std::string& port,
-      const std::string& doc_root, std::size_t thread_pool_size);
+      const std::string& doc_root, std::size_t thread_pool_size,
+      const server_options& options = server_options());
 
   /// Register a custom request handler
   void register_handler(std::shared_ptr<registered_handler> handler);
@@ -46,11 +53,70 @@ public:
   virtual ~server();
 
 private:
-  /// Initiate an asynchronous accept operation.
-  void start_accept();
+  /// An io_service together with the acceptor feeding it connections. In
+  /// shared mode one shard is run by every thread, in sharded mode each
+  /// thread runs a shard of its own.
+  struct shard
+    : private boost::noncopyable
+  {
+    explicit shard(std::size_t timer_tick_ms)
+      : acceptor(io_service), accept_strand(io_service),
+        accept_timer(io_service),
+        wheel(new timer_wheel(io_service, timer_tick_ms)) { ; }
 
-  /// Handle completion of an asynchronous accept operation.
-  void handle_accept(const boost::system::error_code& e);
+    /// The io_service used to perform asynchronous operations.
+    boost::asio::io_service io_service;
+
+    /// Acceptor used to listen for incoming connections.
+    boost::asio::ip::tcp::acceptor acceptor;
+
+    /// Strand serialising the completion handlers of the pending accepts.
+    boost::asio::io_service::strand accept_strand;
+
+    /// Timer to retry accepting while paused at the connection limit.
+    boost::asio::steady_timer accept_timer;
+
+    /// Connections waiting to be accepted into while paused.
+    std::vector<connection_ptr> parked;
+
+    /// Deadlines of this shard's connections.
+    timer_wheel_ptr wheel;
+
+    /// Idle connections of this shard, destroyed before the io_service.
+    connection_pool_ptr pool;
+  };
+
+  typedef boost::shared_ptr<shard> shard_ptr;
+
+  /// Create the shards for the requested number of io_services.
+  static std::vector<shard_ptr> create_shards(std::size_t count,
+      std::size_t timer_tick_ms);
+
+  /// Open, bind and listen on the acceptor of the given shard.
+  void open_acceptor(shard& s, const boost::asio::ip::tcp::endpoint& endpoint);
+
+  /// Get a connection to be accepted into from the shard's pool.
+  connection_ptr create_connection(shard& s);
+
+  /// Whether max_connections connections are already open.
+  bool at_connection_limit() const;
+
+  /// Start an accepted connection, or shed it when over the connection limit.
+  void admit(const connection_ptr& new_connection);
+
+  /// Turn away an accepted connection as configured by the overload action.
+  void shed(const connection_ptr& new_connection);
+
+  /// Resume the accepts parked while at the connection limit.
+  void handle_accept_timer(shard& s, const boost::system::error_code& e);
+
+  /// Initiate an asynchronous accept operation into the given connection.
+  void start_accept(shard& s, const connection_ptr& new_connection);
+
+  /// Handle completion of an asynchronous accept operation, then accept any
+  /// further connections already waiting in the listen backlog.
+  void handle_accept(shard& s, connection_ptr new_connection,
+      const boost::system::error_code& e);
 
   /// Handle a request to stop the server.
   void handle_stop();
@@ -58,17 +124,23 @@ private:
   /// The number of threads that will call io_service::run().
   std::size_t thread_pool_size_;
 
-  /// The io_service used to perform asynchronous operations.
-  boost::asio::io_service io_service_;
+  /// Tunables handed to every connection.
+  server_options options_;
+
+  /// Counters reported on /server_status.
+  server_stats stats_;
+
+  /// The 503 reply sent to connections shed at accept, serialized once.
+  std::string overload_response_;
+
+  /// The io_service shards, a single one unless running sharded.
+  std::vector<shard_ptr> shards_;
 
   /// The signal_set is used to register for process termination notifications.
   boost::asio::signal_set signals_;
 
-  /// Acceptor used to listen for incoming connections.
-  boost::asio::ip::tcp::acceptor acceptor_;
-
-  /// The next connection to be accepted.
-  connection_ptr new_connection_;
+  /// Threads running handlers that ask not to run on the io threads.
+  worker_pool workers_;
 
   /// The handler for all incoming requests.
   request_handler request_handler_;
@@ -0,0 +1,222 @@
+//
+// server_options.hpp
+// ~~~~~~~~~~~~~~~~~~
+//
+// Tunables shared by the server and the connections it creates.
+//
+
+#ifndef HTTP_SERVER_SERVER_OPTIONS_HPP
+#define HTTP_SERVER_SERVER_OPTIONS_HPP
+
+#include <cstddef>
+#include <string>
+
+namespace http {
+namespace server {
+
+/// Configuration for a server instance. Defaults are suitable for a small
+/// internal REST service.
+struct server_options
+{
+  /// What happens to connections arriving once max_connections is reached.
+  enum overload_action
+  {
+    /// Send a pre-serialized 503 Service Unavailable with Retry-After, then
+    /// close.
+    overload_reply,
+
+    /// Close the connection immediately.
+    overload_close,
+
+    /// Stop accepting and leave new connections in the listen backlog until
+    /// the count drops.
+    overload_pause_accept
+  };
+
+  /// The maximum number of requests served over a single persistent
+  /// connection before the server closes it. Zero means no limit.
+  std::size_t max_keep_alive_requests;
+
+  /// The maximum number of pipelined requests answered by one gathered write.
+  /// Requests beyond this stay in the read buffer until the write completes.
+  std::size_t max_pipelined_replies;
+
+  /// When true each thread runs its own io_service fed by its own
+  /// SO_REUSEPORT acceptor, and connections stay on the thread that accepted
+  /// them without a strand. When false all threads share one io_service and
+  /// one acceptor.
+  bool sharded;
+
+  /// The number of asynchronous accepts kept outstanding on each acceptor.
+  std::size_t pending_accepts;
+
+  /// The most connections taken from the listen backlog each time an accept
+  /// completes. Accepting stops early once the backlog is empty.
+  std::size_t max_accepts_per_wakeup;
+
+  /// The most idle connection objects each shard keeps for reuse.
+  std::size_t connection_pool_size;
+
+  /// Milliseconds a connection may wait for the first byte of a request
+  /// before it is closed. Zero disables the timeout, as for those below.
+  std::size_t idle_timeout_ms;
+
+  /// Milliseconds allowed from the first byte of a request until its headers
+  /// are complete.
+  std::size_t header_timeout_ms;
+
+  /// Milliseconds allowed from the end of the headers until the body is
+  /// complete.
+  std::size_t body_timeout_ms;
+
+  /// Milliseconds allowed for each write of replies to the client.
+  std::size_t write_timeout_ms;
+
+  /// Resolution of the timer wheel enforcing the timeouts.
+  std::size_t timer_tick_ms;
+
+  /// The most connections open at once across all shards. Zero means no
+  /// limit.
+  std::size_t max_connections;
+
+  /// How connections past max_connections are shed.
+  overload_action connection_overload_action;
+
+  /// The most requests being handled or waiting for their reply to be
+  /// written at once. Requests past the limit get a 503 reply. Zero means
+  /// no limit.
+  std::size_t max_requests_in_flight;
+
+  /// Seconds sent in the Retry-After header of 503 replies when shedding.
+  std::size_t retry_after_seconds;
+
+  /// The most bytes of a file body passed to one sendfile call. Once a chunk
+  /// is sent the connection waits for the socket to be writable again, so
+  /// one large download does not monopolise an io thread.
+  std::size_t sendfile_chunk_size;
+
+  /// Bytes of static file content kept in memory. Zero disables the cache.
+  std::size_t file_cache_bytes;
+
+  /// The largest file kept in the cache, larger files are always sent with
+  /// sendfile.
+  std::size_t file_cache_max_file_size;
+
+  /// Number of independently locked parts of the cache.
+  std::size_t file_cache_shards;
+
+  /// The most ranges honoured in one Range header. Requests asking for more
+  /// get the whole file instead.
+  std::size_t max_ranges;
+
+  /// Whether foo.js.br or foo.js.gz are sent in place of foo.js to clients
+  /// accepting those codings.
+  bool serve_precompressed;
+
+  /// Whether handler output and cached static files are compressed for
+  /// clients accepting gzip or deflate.
+  bool compress_replies;
+
+  /// Bodies smaller than this are never compressed, it would not pay off.
+  std::size_t compress_min_size;
+
+  /// zlib compression level, 1 (fastest) to 9 (smallest).
+  int compression_level;
+
+  /// Bytes of a streamed body queued before its producer is asked to hold
+  /// back until the client catches up.
+  std::size_t stream_high_water_mark;
+
+  /// Milliseconds a connection waits for an asynchronous handler to complete
+  /// its reply before it is closed. Zero disables the timeout.
+  std::size_t handler_timeout_ms;
+
+  /// Threads running handlers whose execution policy asks for a worker.
+  /// Without workers such handlers run on the io threads.
+  std::size_t worker_threads;
+
+  /// Most requests waiting for a worker. Requests past the limit get a 503
+  /// reply.
+  std::size_t worker_queue_limit;
+
+  /// Bytes of stack given to each coroutine handler.
+  std::size_t coroutine_stack_size;
+
+  /// Request bodies larger than this are written to a temporary file
+  /// instead of being held in request::post, for handlers asking for that
+  /// with spills_request_body.
+  std::size_t body_spill_threshold;
+
+  /// Most bytes of request bodies held in memory across all connections.
+  /// Bodies arriving past it for handlers taking a temporary file are
+  /// written to one whatever their size. Other bodies get a 413 reply if
+  /// they could never fit, or a 503 reply while the memory is taken by
+  /// others. Zero means no limit.
+  std::size_t max_body_memory;
+
+  /// Most bytes of a request body, however it is handled. Larger bodies get
+  /// a 413 reply before any of them is read and the connection is closed.
+  /// Zero means no limit.
+  std::size_t max_body_size;
+
+  /// Directory the temporary files of large request bodies are created in.
+  std::string body_spill_directory;
+
+  /// Bytes of a body collected before they are written to its temporary
+  /// file.
+  std::size_t body_spill_buffer_size;
+
+  /// Most bytes of a request line and headers. Larger request heads get a
+  /// 431 reply and the connection is closed.
+  std::size_t max_header_size;
+
+  /// Whether a connection waiting for its next request gives back its read
+  /// buffer, waiting for the socket to become readable before taking one
+  /// again. Otherwise every open connection holds a buffer.
+  bool release_idle_buffers;
+
+  server_options()
+    : max_keep_alive_requests(100),
+      max_pipelined_replies(16),
+      sharded(false),
+      pending_accepts(1),
+      max_accepts_per_wakeup(16),
+      connection_pool_size(256),
+      idle_timeout_ms(30000),
+      header_timeout_ms(10000),
+      body_timeout_ms(60000),
+      write_timeout_ms(60000),
+      timer_tick_ms(100),
+      max_connections(0),
+      connection_overload_action(overload_reply),
+      max_requests_in_flight(0),
+      retry_after_seconds(1),
+      sendfile_chunk_size(256 * 1024),
+      file_cache_bytes(64 * 1024 * 1024),
+      file_cache_max_file_size(256 * 1024),
+      file_cache_shards(16),
+      max_ranges(16),
+      serve_precompressed(true),
+      compress_replies(true),
+      compress_min_size(1024),
+      compression_level(6),
+      stream_high_water_mark(64 * 1024),
+      handler_timeout_ms(60000),
+      worker_threads(0),
+      worker_queue_limit(1024),
+      coroutine_stack_size(64 * 1024),
+      body_spill_threshold(1024 * 1024),
+      max_body_memory(64 * 1024 * 1024),
+      max_body_size(1024 * 1024 * 1024),
+      body_spill_directory("/tmp"),
+      body_spill_buffer_size(64 * 1024),
+      max_header_size(64 * 1024),
+      release_idle_buffers(true)
+  {
+  }
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_SERVER_SERVER_OPTIONS_HPP
@@ -0,0 +1,212 @@
+//
+// server_stats.hpp
+// ~~~~~~~~~~~~~~~~
+//
+// Counters updated by the server and its connections, reported on
+// /server_status.
+//
+
+#ifndef HTTP_SERVER_SERVER_STATS_HPP
+#define HTTP_SERVER_SERVER_STATS_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <boost/noncopyable.hpp>
+
+namespace http {
+namespace server {
+
+/// Server wide counters. Every member may be updated concurrently from any
+/// io thread.
+struct server_stats
+  : private boost::noncopyable
+{
+  /// Number of times an accept completion handler ran.
+  std::atomic<std::size_t> accept_wakeups;
+
+  /// Number of connections accepted.
+  std::atomic<std::size_t> connections_accepted;
+
+  /// The most connections accepted by a single accept completion handler.
+  std::atomic<std::size_t> max_accepts_per_wakeup;
+
+  /// Number of connections taken from a connection pool.
+  std::atomic<std::size_t> connection_pool_hits;
+
+  /// Number of connections allocated because a pool was empty.
+  std::atomic<std::size_t> connection_pool_misses;
+
+  /// Number of memory requests made for connection completion handlers.
+  std::atomic<std::size_t> handler_allocations;
+
+  /// Number of those requests that could not be met from the connection's
+  /// own handler memory and went to the heap.
+  std::atomic<std::size_t> handler_heap_allocations;
+
+  /// Number of connections closed after waiting too long for a request.
+  std::atomic<std::size_t> idle_timeouts;
+
+  /// Number of connections closed while receiving request headers.
+  std::atomic<std::size_t> header_timeouts;
+
+  /// Number of connections closed while receiving a request body.
+  std::atomic<std::size_t> body_timeouts;
+
+  /// Number of connections closed while a reply could not be written.
+  std::atomic<std::size_t> write_timeouts;
+
+  /// Number of connections currently open.
+  std::atomic<std::size_t> active_connections;
+
+  /// Number of requests being handled or waiting for their reply to be
+  /// written.
+  std::atomic<std::size_t> requests_in_flight;
+
+  /// Number of connections turned away at accept.
+  std::atomic<std::size_t> connections_shed;
+
+  /// Number of requests answered with 503 because too many were in flight.
+  std::atomic<std::size_t> requests_shed;
+
+  /// Number of static file requests served from the file cache.
+  std::atomic<std::size_t> file_cache_hits;
+
+  /// Number of static file requests not found in the file cache.
+  std::atomic<std::size_t> file_cache_misses;
+
+  /// Number of files dropped from the cache to stay within its budget.
+  std::atomic<std::size_t> file_cache_evictions;
+
+  /// Number of files dropped from the cache because they changed.
+  std::atomic<std::size_t> file_cache_invalidations;
+
+  /// Number of 206 Partial Content replies.
+  std::atomic<std::size_t> partial_replies;
+
+  /// Number of 416 Range Not Satisfiable replies.
+  std::atomic<std::size_t> unsatisfiable_ranges;
+
+  /// Number of replies sent with a content coding.
+  std::atomic<std::size_t> compressed_replies;
+
+  /// Bytes given to the compressor.
+  std::atomic<std::size_t> compression_bytes_in;
+
+  /// Bytes produced by the compressor.
+  std::atomic<std::size_t> compression_bytes_out;
+
+  /// Number of replies with a streamed body.
+  std::atomic<std::size_t> streamed_replies;
+
+  /// Number of request bodies streamed to their handlers.
+  std::atomic<std::size_t> streamed_request_bodies;
+
+  /// Number of request bodies written to a temporary file.
+  std::atomic<std::size_t> spilled_request_bodies;
+
+  /// Bytes of request bodies currently held in memory.
+  std::atomic<std::size_t> request_body_bytes;
+
+  /// Number of requests refused because their body was too large or could
+  /// not be held.
+  std::atomic<std::size_t> refused_bodies;
+
+  /// Bytes of memory currently held by connection read buffers.
+  std::atomic<std::size_t> read_buffer_bytes;
+
+  /// Number of connections waiting for a request with nothing buffered.
+  std::atomic<std::size_t> idle_connections;
+
+  /// Bytes of read buffers held by idle connections.
+  std::atomic<std::size_t> idle_read_buffer_bytes;
+
+  /// Number of requests refused because their head was too large.
+  std::atomic<std::size_t> oversized_heads;
+
+  /// Number of replies completed by asynchronous handlers.
+  std::atomic<std::size_t> deferred_replies;
+
+  /// Number of connections closed waiting for an asynchronous handler.
+  std::atomic<std::size_t> handler_timeouts;
+
+  /// Number of handlers run by the worker pool.
+  std::atomic<std::size_t> worker_tasks;
+
+  /// Number of requests turned away because the worker queue was full.
+  std::atomic<std::size_t> worker_rejected;
+
+  /// Total microseconds handlers waited in the worker queue.
+  std::atomic<std::size_t> worker_wait_us;
+
+  /// Longest wait in the worker queue in microseconds.
+  std::atomic<std::size_t> worker_max_wait_us;
+
+  /// Number of requests handed to coroutine handlers.
+  std::atomic<std::size_t> coroutines_started;
+
+  /// Number of coroutine handlers yet to complete their reply.
+  std::atomic<std::size_t> coroutines_active;
+
+  server_stats()
+    : accept_wakeups(0),
+      connections_accepted(0),
+      max_accepts_per_wakeup(0),
+      connection_pool_hits(0),
+      connection_pool_misses(0),
+      handler_allocations(0),
+      handler_heap_allocations(0),
+      idle_timeouts(0),
+      header_timeouts(0),
+      body_timeouts(0),
+      write_timeouts(0),
+      active_connections(0),
+      requests_in_flight(0),
+      connections_shed(0),
+      requests_shed(0),
+      file_cache_hits(0),
+      file_cache_misses(0),
+      file_cache_evictions(0),
+      file_cache_invalidations(0),
+      partial_replies(0),
+      unsatisfiable_ranges(0),
+      compressed_replies(0),
+      compression_bytes_in(0),
+      compression_bytes_out(0),
+      streamed_replies(0),
+      streamed_request_bodies(0),
+      spilled_request_bodies(0),
+      request_body_bytes(0),
+      refused_bodies(0),
+      read_buffer_bytes(0),
+      idle_connections(0),
+      idle_read_buffer_bytes(0),
+      oversized_heads(0),
+      deferred_replies(0),
+      handler_timeouts(0),
+      worker_tasks(0),
+      worker_rejected(0),
+      worker_wait_us(0),
+      worker_max_wait_us(0),
+      coroutines_started(0),
+      coroutines_active(0)
+  {
+  }
+
+  /// Record a run of the accept handler that accepted the given number of
+  /// connections.
+  void record_accept_wakeup(std::size_t accepted)
+  {
+    ++accept_wakeups;
+    connections_accepted += accepted;
+    std::size_t current = max_accepts_per_wakeup.load();
+    while (accepted > current
+        && !max_accepts_per_wakeup.compare_exchange_weak(current, accepted))
+    {
+    }
+  }
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_SERVER_SERVER_STATS_HPP
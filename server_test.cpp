@@ -0,0 +1,1511 @@
+//
+// server_test.cpp
+// ~~~~~~~~~~~~~~~
+//
+// Runs the server in process and talks to it over loopback, checking what
+// goes over the wire.
+//
+
+#define BOOST_TEST_MODULE server_test
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <cctype>
+#include <cstdio>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <zlib.h>
+#include "content_coding.hpp"
+#include "server.hpp"
+
+using namespace http::server;
+
+namespace {
+
+const char* const test_port = "18089";
+
+/// A reply as the client saw it. Header names are lower case.
+struct response
+{
+  std::string status_line;
+  std::map<std::string, std::string> headers;
+  std::string body;
+  /// Number of chunks, including the last, of a chunked body.
+  std::size_t chunks;
+
+  response() : chunks(0) { ; }
+
+  std::string header(const std::string& name) const
+  {
+    std::map<std::string, std::string>::const_iterator found = headers.find(name);
+    return found == headers.end() ? std::string() : found->second;
+  }
+};
+
+/// A server listening on loopback, run on threads of its own for the
+/// lifetime of the object.
+class running_server
+{
+public:
+  explicit running_server(const server_options& options = server_options(),
+      const std::string& doc_root = ".")
+    : server_("127.0.0.1", test_port, doc_root, 2, options),
+      thread_(boost::bind(&server::run, &server_))
+  {
+  }
+
+  ~running_server()
+  {
+    server_.stop();
+    thread_.join();
+  }
+
+  server& get() { return server_; }
+
+private:
+  server server_;
+  boost::thread thread_;
+};
+
+/// A temporary document root, removed with everything in it when the object
+/// is destroyed.
+class temp_doc_root
+{
+public:
+  temp_doc_root()
+  {
+    char path[] = "/tmp/server_test.XXXXXX";
+    BOOST_REQUIRE(::mkdtemp(path));
+    path_ = path;
+  }
+
+  ~temp_doc_root()
+  {
+    std::string command = "rm -rf '" + path_ + "'";
+    if (std::system(command.c_str()) != 0)
+      BOOST_TEST_MESSAGE("could not remove " + path_);
+  }
+
+  const std::string& path() const { return path_; }
+
+  /// Write a file, relative to the root.
+  void write(const std::string& name, const std::string& content)
+  {
+    std::ofstream out((path_ + "/" + name).c_str(), std::ios::binary);
+    out << content;
+    BOOST_REQUIRE(out);
+  }
+
+  void rename(const std::string& from, const std::string& to)
+  {
+    BOOST_REQUIRE(::rename((path_ + "/" + from).c_str(), (path_ + "/" + to).c_str()) == 0);
+  }
+
+  void mkdir(const std::string& name)
+  {
+    BOOST_REQUIRE(::mkdir((path_ + "/" + name).c_str(), 0700) == 0);
+  }
+
+private:
+  std::string path_;
+};
+
+/// Content long enough to span several sendfile chunks, with no repeating
+/// pattern a misplaced chunk could hide in.
+std::string file_content(std::size_t size)
+{
+  std::string content(size, ' ');
+  for (std::size_t i = 0; i < size; ++i)
+    content[i] = static_cast<char>('a' + (i * 7 + i / 26) % 26);
+  return content;
+}
+
+/// Streams count pieces of piece_size bytes, from a thread of its own and
+/// then from drain handlers.
+class counting_stream_handler : public streaming_handler
+{
+public:
+  counting_stream_handler(std::size_t count, std::size_t piece_size)
+    : streaming_handler("/stream"), count_(count), piece_size_(piece_size) { ; }
+
+  void handle_stream(const request&, reply& rep, const reply_stream_ptr& stream) const
+  {
+    rep.status = reply::ok;
+    rep.headers.insert(std::make_pair(std::string("Content-Type"), std::string("text/plain")));
+    boost::shared_ptr<producer> p(new producer(stream, count_, piece_size_));
+    stream->on_drain(boost::bind(&producer::run, p));
+    boost::thread(boost::bind(&producer::run, p)).detach();
+  }
+
+  const char* usage_info() const { return "Streams a counted body"; }
+
+  /// The whole body the handler streams.
+  std::string body() const
+  {
+    std::string b;
+    for (std::size_t i = 0; i < count_; ++i)
+      b += piece(i, piece_size_);
+    return b;
+  }
+
+  static std::string piece(std::size_t i, std::size_t size)
+  {
+    return std::string(size, static_cast<char>('a' + i % 26));
+  }
+
+private:
+  struct producer
+  {
+    producer(const reply_stream_ptr& s, std::size_t c, std::size_t size)
+      : stream(s), next(0), count(c), piece_size(size) { ; }
+
+    void run()
+    {
+      boost::mutex::scoped_lock lock(mutex);
+      while (!stream->closed() && next < count)
+      {
+        if (!stream->write(piece(next++, piece_size)))
+          return;
+      }
+      if (next == count)
+      {
+        stream->finish();
+        ++next;
+      }
+    }
+
+    boost::mutex mutex;
+    reply_stream_ptr stream;
+    std::size_t next;
+    std::size_t count;
+    std::size_t piece_size;
+  };
+
+  std::size_t count_;
+  std::size_t piece_size_;
+};
+
+/// Completes replies after a delay from a thread of its own, or never when
+/// the delay is negative.
+class delayed_handler : public async_handler
+{
+public:
+  explicit delayed_handler(int delay_ms)
+    : async_handler("/later"), delay_ms_(delay_ms), cancelled_(0) { ; }
+
+  void handle_async(const request& req, const deferred_reply_ptr& rep) const
+  {
+    boost::thread(boost::bind(&delayed_handler::complete, this, req.uri, rep)).detach();
+  }
+
+  const char* usage_info() const { return "Replies later"; }
+
+  /// Number of replies found cancelled instead of completed.
+  int cancelled() const { return cancelled_; }
+
+private:
+  void complete(const std::string& uri, const deferred_reply_ptr& rep) const
+  {
+    if (delay_ms_ < 0)
+    {
+      while (!rep->cancelled())
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+      ++cancelled_;
+      return;
+    }
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(delay_ms_));
+    reply r;
+    r.status = reply::ok;
+    r.content = uri;
+    r.headers.insert(std::make_pair(std::string("Content-Type"), std::string("text/plain")));
+    rep->complete(r);
+  }
+
+  int delay_ms_;
+  mutable boost::atomic<int> cancelled_;
+};
+
+/// Takes its time over each request, on a worker thread.
+class slow_worker_handler : public registered_handler
+{
+public:
+  explicit slow_worker_handler(int delay_ms)
+    : registered_handler("/work"), delay_ms_(delay_ms) { ; }
+
+  execution_policy get_execution_policy() const { return execute_on_worker; }
+
+  void handle_request(const request& req, reply& rep) const
+  {
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(delay_ms_));
+    rep.status = reply::ok;
+    rep.content = req.uri;
+    rep.headers.insert(std::make_pair(std::string("Content-Type"), std::string("text/plain")));
+  }
+
+  const char* usage_info() const { return "Works slowly"; }
+
+private:
+  int delay_ms_;
+};
+
+/// Waits on a timer without holding up the io thread, then replies, or
+/// throws when asked to.
+class waiting_coroutine_handler : public coroutine_handler
+{
+public:
+  explicit waiting_coroutine_handler(int delay_ms)
+    : coroutine_handler("/wait"), delay_ms_(delay_ms) { ; }
+
+  void handle_coroutine(const request& req, reply& rep,
+      boost::asio::io_service& io_service, boost::asio::yield_context yield) const
+  {
+    boost::asio::deadline_timer timer(io_service,
+        boost::posix_time::milliseconds(delay_ms_));
+    timer.async_wait(yield);
+    if (req.uri.find("throw") != std::string::npos)
+      throw std::runtime_error("asked to throw");
+    rep.status = reply::ok;
+    rep.content = req.uri;
+    rep.headers.insert(std::make_pair(std::string("Content-Type"), std::string("text/plain")));
+  }
+
+  const char* usage_info() const { return "Waits before replying"; }
+
+private:
+  int delay_ms_;
+};
+
+/// Takes request bodies as they arrive, pausing now and then and resuming
+/// from another thread, and replies with what it received.
+class upload_handler : public async_handler
+{
+public:
+  upload_handler() : async_handler("/upload"), aborted_(0) { ; }
+
+  bool streams_request_body() const { return true; }
+
+  void handle_async(const request& req, const deferred_reply_ptr& rep) const
+  {
+    boost::shared_ptr<upload> u(new upload(req.body, rep, aborted_));
+    req.body->on_data(boost::bind(&upload::data, u, _1, _2));
+    req.body->on_end(boost::bind(&upload::end, u, _1));
+  }
+
+  const char* usage_info() const { return "Takes uploads"; }
+
+  /// Number of bodies that ended before they were complete.
+  int aborted() const { return aborted_; }
+
+  /// What the handler replies for a body.
+  static std::string summary(const std::string& body)
+  {
+    std::size_t sum = 0;
+    for (std::size_t i = 0; i < body.size(); ++i)
+      sum += static_cast<unsigned char>(body[i]);
+    return boost::lexical_cast<std::string>(body.size()) + " "
+      + boost::lexical_cast<std::string>(sum);
+  }
+
+private:
+  struct upload
+  {
+    upload(const request_body_ptr& b, const deferred_reply_ptr& r, boost::atomic<int>& a)
+      : body(b), rep(r), aborted(a), size(0), sum(0), fragments(0) { ; }
+
+    void data(const char* data, std::size_t n)
+    {
+      size += n;
+      for (std::size_t i = 0; i < n; ++i)
+        sum += static_cast<unsigned char>(data[i]);
+      if (++fragments % 8 == 1)
+      {
+        body->pause();
+        boost::thread(boost::bind(&request_body::resume, body)).detach();
+      }
+    }
+
+    void end(bool complete)
+    {
+      if (!complete)
+      {
+        ++aborted;
+        return;
+      }
+      reply r;
+      r.status = reply::ok;
+      r.content = boost::lexical_cast<std::string>(size) + " "
+        + boost::lexical_cast<std::string>(sum);
+      r.headers.insert(std::make_pair(std::string("Content-Type"), std::string("text/plain")));
+      rep->complete(r);
+    }
+
+    request_body_ptr body;
+    deferred_reply_ptr rep;
+    boost::atomic<int>& aborted;
+    std::size_t size;
+    std::size_t sum;
+    std::size_t fragments;
+  };
+
+  mutable boost::atomic<int> aborted_;
+};
+
+/// Replies straight away and counts the bytes of the request body as they
+/// arrive, unless asked to ignore it.
+class counting_upload_handler : public registered_handler
+{
+public:
+  counting_upload_handler() : registered_handler("/count"), received_(0), ended_(0) { ; }
+
+  bool streams_request_body() const { return true; }
+
+  void handle_request(const request& req, reply& rep) const
+  {
+    if (req.body && req.uri.find("ignore") == std::string::npos)
+    {
+      req.body->on_data(boost::bind(&counting_upload_handler::data, this, _1, _2));
+      req.body->on_end(boost::bind(&counting_upload_handler::end, this, _1));
+    }
+    rep.status = reply::ok;
+    rep.content = "counting";
+    rep.headers.insert(std::make_pair(std::string("Content-Type"), std::string("text/plain")));
+  }
+
+  const char* usage_info() const { return "Counts uploads"; }
+
+  std::size_t received() const { return received_; }
+
+  /// Number of bodies delivered completely.
+  int ended() const { return ended_; }
+
+private:
+  void data(const char*, std::size_t n) const { received_ += n; }
+
+  void end(bool complete) const { ended_ += complete; }
+
+  mutable boost::atomic<std::size_t> received_;
+  mutable boost::atomic<int> ended_;
+};
+
+/// Replies with where the body was held, its size and its byte sum.
+class body_summary_handler : public registered_handler
+{
+public:
+  body_summary_handler() : registered_handler("/summary") { ; }
+
+  bool spills_request_body() const { return true; }
+
+  void handle_request(const request& req, reply& rep) const
+  {
+    std::string body = req.post;
+    if (req.post_file)
+    {
+      body.resize(req.post_file->length);
+      std::size_t read = 0;
+      while (read < body.size())
+      {
+        ssize_t n = ::pread(req.post_file->descriptor(), &body[read], body.size() - read, read);
+        if (n <= 0)
+          break;
+        read += n;
+      }
+    }
+    rep.status = reply::ok;
+    rep.content = (req.post_file ? "file " : "memory ") + upload_handler::summary(body);
+    rep.headers.insert(std::make_pair(std::string("Content-Type"), std::string("text/plain")));
+  }
+
+  const char* usage_info() const { return "Sums the body"; }
+};
+
+/// Inflate a gzip body.
+std::string gunzip(const std::string& data)
+{
+  z_stream z;
+  std::memset(&z, 0, sizeof(z));
+  BOOST_REQUIRE(::inflateInit2(&z, 16 + MAX_WBITS) == Z_OK);
+  z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  z.avail_in = static_cast<uInt>(data.size());
+  std::string out;
+  int result = Z_OK;
+  while (result == Z_OK)
+  {
+    char chunk[4096];
+    z.next_out = reinterpret_cast<Bytef*>(chunk);
+    z.avail_out = sizeof(chunk);
+    result = ::inflate(&z, Z_NO_FLUSH);
+    out.append(chunk, sizeof(chunk) - z.avail_out);
+  }
+  ::inflateEnd(&z);
+  BOOST_CHECK_EQUAL(result, Z_STREAM_END);
+  return out;
+}
+
+/// A blocking client connection. Reads give up after a few seconds, so a
+/// server that never answers fails the test instead of hanging it.
+class client
+{
+public:
+  client()
+    : socket_(io_service_)
+  {
+    socket_.connect(boost::asio::ip::tcp::endpoint(
+          boost::asio::ip::address::from_string("127.0.0.1"),
+          static_cast<unsigned short>(std::atoi(test_port))));
+    struct timeval timeout = { 5, 0 };
+    ::setsockopt(socket_.native_handle(), SOL_SOCKET, SO_RCVTIMEO,
+        &timeout, sizeof(timeout));
+  }
+
+  void send(const std::string& data)
+  {
+    boost::asio::write(socket_, boost::asio::buffer(data));
+  }
+
+  /// Read the next reply, framed by its Content-Length or, without one, by
+  /// the end of the connection, or decoded from its chunks. A 304 has no
+  /// body.
+  response read_reply()
+  {
+    response r;
+    std::size_t end;
+    while ((end = buffer_.find("\r\n\r\n")) == std::string::npos)
+      BOOST_REQUIRE_MESSAGE(fill(), "connection ended before a reply head");
+
+    std::string head = buffer_.substr(0, end + 2);
+    buffer_.erase(0, end + 4);
+    std::size_t line_end = head.find("\r\n");
+    r.status_line = head.substr(0, line_end);
+    for (std::size_t begin = line_end + 2; begin < head.size();)
+    {
+      line_end = head.find("\r\n", begin);
+      std::string line = head.substr(begin, line_end - begin);
+      std::size_t colon = line.find(':');
+      std::string name = line.substr(0, colon);
+      for (std::size_t i = 0; i < name.size(); ++i)
+        name[i] = std::tolower(static_cast<unsigned char>(name[i]));
+      r.headers[name] = line.substr(line.find_first_not_of(' ', colon + 1));
+      begin = line_end + 2;
+    }
+
+    if (r.status_line.compare(9, 3, "304") == 0)
+    {
+      // Never has a body, whatever the headers say.
+    }
+    else if (r.header("transfer-encoding") == "chunked")
+    {
+      for (;;)
+      {
+        std::size_t line_end;
+        while ((line_end = buffer_.find("\r\n")) == std::string::npos)
+          BOOST_REQUIRE_MESSAGE(fill(), "connection ended inside a chunk size");
+        std::size_t size = std::strtoul(buffer_.c_str(), 0, 16);
+        while (buffer_.size() < line_end + 2 + size + 2)
+          BOOST_REQUIRE_MESSAGE(fill(), "connection ended inside a chunk");
+        r.body.append(buffer_, line_end + 2, size);
+        BOOST_CHECK_EQUAL(buffer_.compare(line_end + 2 + size, 2, "\r\n"), 0);
+        buffer_.erase(0, line_end + 2 + size + 2);
+        ++r.chunks;
+        if (size == 0)
+          break;
+      }
+    }
+    else if (r.headers.count("content-length"))
+    {
+      std::size_t length = std::strtoul(r.header("content-length").c_str(), 0, 10);
+      while (buffer_.size() < length)
+        BOOST_REQUIRE_MESSAGE(fill(), "connection ended inside a reply body");
+      r.body = buffer_.substr(0, length);
+      buffer_.erase(0, length);
+    }
+    else
+    {
+      while (fill())
+        ;
+      r.body.swap(buffer_);
+    }
+    return r;
+  }
+
+  /// Whether the server closed the connection without sending anything
+  /// more.
+  bool closed()
+  {
+    return buffer_.empty() && !fill();
+  }
+
+private:
+  /// Read more data into the buffer. Returns false at the end of the
+  /// connection.
+  bool fill()
+  {
+    // Read with recv, asio would wait out the receive timeout itself.
+    char data[8192];
+    ssize_t n = ::recv(socket_.native_handle(), data, sizeof(data), 0);
+    if (n == 0 || (n < 0 && errno == ECONNRESET))
+      return false;
+    BOOST_REQUIRE_MESSAGE(n > 0, "read failed: " + std::string(std::strerror(errno)));
+    buffer_.append(data, n);
+    return true;
+  }
+
+  boost::asio::io_service io_service_;
+  boost::asio::ip::tcp::socket socket_;
+  std::string buffer_;
+};
+
+std::string get(const std::string& uri, const std::string& headers = std::string())
+{
+  return "GET " + uri + " HTTP/1.1\r\nHost: localhost\r\n" + headers + "\r\n";
+}
+
+std::string post(const std::string& uri, const std::string& body)
+{
+  return "POST " + uri + " HTTP/1.1\r\nHost: localhost\r\n"
+    "Content-Type: text/plain\r\nContent-Length: "
+    + boost::lexical_cast<std::string>(body.size()) + "\r\n\r\n" + body;
+}
+
+/// A counter from the status page of a server.
+std::size_t status_count(const std::string& label)
+{
+  client c;
+  c.send(get("/server_status"));
+  std::string body = c.read_reply().body;
+  std::size_t found = body.find(label + ": ");
+  BOOST_REQUIRE_MESSAGE(found != std::string::npos, "no " + label + " on the status page");
+  return std::strtoul(body.c_str() + found + label.size() + 2, 0, 10);
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(http_1_1_connections_persist)
+{
+  running_server s;
+  client c;
+  for (int i = 0; i < 3; ++i)
+  {
+    c.send(get("/echo"));
+    response r = c.read_reply();
+    BOOST_CHECK_EQUAL(r.status_line, "HTTP/1.1 200 OK");
+    BOOST_CHECK_EQUAL(r.header("connection"), "keep-alive");
+  }
+}
+
+BOOST_AUTO_TEST_CASE(http_1_0_connections_persist_only_on_request)
+{
+  running_server s;
+  {
+    client c;
+    c.send("GET /echo HTTP/1.0\r\n\r\n");
+    BOOST_CHECK_EQUAL(c.read_reply().header("connection"), "close");
+    BOOST_CHECK(c.closed());
+  }
+  client c;
+  c.send("GET /echo HTTP/1.0\r\nConnection: keep-alive\r\n\r\n");
+  BOOST_CHECK_EQUAL(c.read_reply().header("connection"), "keep-alive");
+  c.send("GET /echo HTTP/1.0\r\nConnection: keep-alive\r\n\r\n");
+  BOOST_CHECK_EQUAL(c.read_reply().header("connection"), "keep-alive");
+}
+
+BOOST_AUTO_TEST_CASE(connection_close_is_honoured)
+{
+  running_server s;
+  client c;
+  c.send(get("/echo", "Connection: close\r\n"));
+  BOOST_CHECK_EQUAL(c.read_reply().header("connection"), "close");
+  BOOST_CHECK(c.closed());
+}
+
+BOOST_AUTO_TEST_CASE(keep_alive_requests_are_limited)
+{
+  server_options options;
+  options.max_keep_alive_requests = 2;
+  running_server s(options);
+  client c;
+  c.send(get("/echo"));
+  BOOST_CHECK_EQUAL(c.read_reply().header("connection"), "keep-alive");
+  c.send(get("/echo"));
+  BOOST_CHECK_EQUAL(c.read_reply().header("connection"), "close");
+  BOOST_CHECK(c.closed());
+}
+
+BOOST_AUTO_TEST_CASE(shorter_body_follows_longer_one)
+{
+  running_server s;
+  client c;
+  c.send(post("/echo", std::string(100, 'a')));
+  BOOST_CHECK_EQUAL(c.read_reply().status_line, "HTTP/1.1 200 OK");
+  c.send(post("/echo", std::string(40, 'b')));
+  BOOST_CHECK_EQUAL(c.read_reply().status_line, "HTTP/1.1 200 OK");
+}
+
+BOOST_AUTO_TEST_CASE(short_bodies_complete)
+{
+  running_server s;
+  client c;
+  for (std::size_t size = 0; size < 40; ++size)
+  {
+    c.send(post("/echo", std::string(size, 'x')) + get("/echo/next"));
+    BOOST_CHECK_EQUAL(c.read_reply().status_line, "HTTP/1.1 200 OK");
+    BOOST_CHECK(c.read_reply().body.find("/echo/next") != std::string::npos);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(malformed_request_closes_the_connection)
+{
+  running_server s;
+  client c;
+  c.send("GET\r\n\r\n");
+  response r = c.read_reply();
+  BOOST_CHECK_EQUAL(r.status_line, "HTTP/1.1 400 Bad Request");
+  BOOST_CHECK_EQUAL(r.header("connection"), "close");
+  BOOST_CHECK(c.closed());
+}
+
+BOOST_AUTO_TEST_CASE(chunked_requests_get_501)
+{
+  running_server s;
+  client c;
+  c.send("POST /echo HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\n\r\n"
+      "5\r\nhello\r\n0\r\n\r\n");
+  response r = c.read_reply();
+  BOOST_CHECK_EQUAL(r.status_line, "HTTP/1.1 501 Not Implemented");
+  BOOST_CHECK_EQUAL(r.header("connection"), "close");
+  BOOST_CHECK(c.closed());
+}
+
+BOOST_AUTO_TEST_CASE(pipelined_requests_are_answered_in_order)
+{
+  server_options options;
+  options.max_pipelined_replies = 2;
+  running_server s(options);
+  client c;
+  std::string requests;
+  for (int i = 0; i < 5; ++i)
+    requests += get("/echo/" + boost::lexical_cast<std::string>(i));
+  requests += post("/echo/5", std::string(100, 'a'));
+  requests += get("/echo/6");
+  c.send(requests);
+  for (int i = 0; i < 7; ++i)
+  {
+    response r = c.read_reply();
+    BOOST_CHECK_EQUAL(r.status_line, "HTTP/1.1 200 OK");
+    BOOST_CHECK(r.body.find("/echo/" + boost::lexical_cast<std::string>(i)) != std::string::npos);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(requests_after_connection_close_are_ignored)
+{
+  running_server s;
+  client c;
+  c.send(get("/echo/1", "Connection: close\r\n") + get("/echo/2"));
+  response r = c.read_reply();
+  BOOST_CHECK(r.body.find("/echo/1") != std::string::npos);
+  BOOST_CHECK(c.closed());
+}
+
+BOOST_AUTO_TEST_CASE(sharded_mode_serves_every_connection)
+{
+  server_options options;
+  options.sharded = true;
+  running_server s(options);
+  std::vector<boost::shared_ptr<client> > clients;
+  for (int i = 0; i < 8; ++i)
+    clients.push_back(boost::shared_ptr<client>(new client()));
+  for (int round = 0; round < 2; ++round)
+  {
+    for (std::size_t i = 0; i < clients.size(); ++i)
+      clients[i]->send(get("/echo"));
+    for (std::size_t i = 0; i < clients.size(); ++i)
+      BOOST_CHECK_EQUAL(clients[i]->read_reply().status_line, "HTTP/1.1 200 OK");
+  }
+}
+
+BOOST_AUTO_TEST_CASE(accept_bursts_are_drained)
+{
+  server_options options;
+  options.pending_accepts = 2;
+  options.max_accepts_per_wakeup = 4;
+  running_server s(options);
+  std::vector<boost::shared_ptr<client> > clients;
+  for (int i = 0; i < 50; ++i)
+    clients.push_back(boost::shared_ptr<client>(new client()));
+  for (std::size_t i = 0; i < clients.size(); ++i)
+  {
+    clients[i]->send(get("/echo"));
+    BOOST_CHECK_EQUAL(clients[i]->read_reply().status_line, "HTTP/1.1 200 OK");
+  }
+  BOOST_CHECK_EQUAL(status_count("Connections Accepted"), 51u);
+}
+
+BOOST_AUTO_TEST_CASE(recycled_connections_start_afresh)
+{
+  running_server s;
+  for (int i = 0; i < 4; ++i)
+  {
+    client c;
+    // A body cut short by the client must not be taken for the start of the
+    // next client's request.
+    c.send(i % 2 ? get("/echo/" + boost::lexical_cast<std::string>(i))
+        : post("/echo", std::string(100, 'a')).substr(0, 120));
+    if (i % 2)
+      BOOST_CHECK(c.read_reply().body.find("/echo/" + boost::lexical_cast<std::string>(i))
+          != std::string::npos);
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(50));
+  }
+  BOOST_CHECK(status_count("Connection Pool Hits") > 0);
+}
+
+BOOST_AUTO_TEST_CASE(keep_alive_traffic_allocates_no_handlers)
+{
+  running_server s;
+  std::size_t heap = status_count("Handler Heap Allocations");
+  std::size_t total = status_count("Handler Allocations");
+  client c;
+  for (int i = 0; i < 20; ++i)
+  {
+    c.send(get("/echo"));
+    c.read_reply();
+  }
+  BOOST_CHECK(status_count("Handler Allocations") > total + 20);
+  BOOST_CHECK_EQUAL(status_count("Handler Heap Allocations"), heap);
+}
+
+BOOST_AUTO_TEST_CASE(idle_connections_are_closed)
+{
+  server_options options;
+  options.idle_timeout_ms = 200;
+  options.timer_tick_ms = 10;
+  running_server s(options);
+  client c;
+  c.send(get("/echo"));
+  BOOST_CHECK_EQUAL(c.read_reply().status_line, "HTTP/1.1 200 OK");
+  boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
+  c.send(get("/echo"));
+  BOOST_CHECK_EQUAL(c.read_reply().status_line, "HTTP/1.1 200 OK");
+  BOOST_CHECK(c.closed());
+  BOOST_CHECK_EQUAL(status_count("Idle Timeouts"), 1u);
+}
+
+BOOST_AUTO_TEST_CASE(slow_request_heads_time_out)
+{
+  server_options options;
+  options.header_timeout_ms = 200;
+  options.timer_tick_ms = 10;
+  running_server s(options);
+  client c;
+  // Bytes keep arriving, but the head is never finished.
+  std::string request = get("/echo");
+  for (std::size_t i = 0; i < 3; ++i)
+  {
+    c.send(request.substr(i, 1));
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(50));
+  }
+  BOOST_CHECK(c.closed());
+  BOOST_CHECK_EQUAL(status_count("Header Timeouts"), 1u);
+}
+
+BOOST_AUTO_TEST_CASE(connections_past_the_limit_are_shed)
+{
+  server_options options;
+  options.max_connections = 2;
+  options.retry_after_seconds = 7;
+  running_server s(options);
+  {
+    client a, b;
+    a.send(get("/echo"));
+    BOOST_CHECK_EQUAL(a.read_reply().status_line, "HTTP/1.1 200 OK");
+    b.send(get("/echo"));
+    BOOST_CHECK_EQUAL(b.read_reply().status_line, "HTTP/1.1 200 OK");
+
+    client c;
+    c.send(get("/echo"));
+    response r = c.read_reply();
+    BOOST_CHECK_EQUAL(r.status_line, "HTTP/1.1 503 Service Unavailable");
+    BOOST_CHECK_EQUAL(r.header("retry-after"), "7");
+    BOOST_CHECK(c.closed());
+  }
+  boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
+  BOOST_CHECK_EQUAL(status_count("Connections Shed"), 1u);
+}
+
+BOOST_AUTO_TEST_CASE(paused_accepts_resume_when_a_connection_closes)
+{
+  server_options options;
+  options.max_connections = 1;
+  options.connection_overload_action = server_options::overload_pause_accept;
+  options.timer_tick_ms = 10;
+  running_server s(options);
+  boost::shared_ptr<client> a(new client());
+  a->send(get("/echo/a"));
+  BOOST_CHECK_EQUAL(a->read_reply().status_line, "HTTP/1.1 200 OK");
+
+  // The second client waits in the listen backlog until the first leaves.
+  client b;
+  b.send(get("/echo/b"));
+  boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
+  a.reset();
+  response r = b.read_reply();
+  BOOST_CHECK_EQUAL(r.status_line, "HTTP/1.1 200 OK");
+  BOOST_CHECK(r.body.find("/echo/b") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(requests_past_the_in_flight_limit_are_shed)
+{
+  server_options options;
+  options.max_requests_in_flight = 1;
+  running_server s(options);
+  client c;
+  // Parsed together, the second request arrives while the first one's reply
+  // is still waiting to be written.
+  c.send(get("/echo/1") + get("/echo/2"));
+  BOOST_CHECK_EQUAL(c.read_reply().status_line, "HTTP/1.1 200 OK");
+  response r = c.read_reply();
+  BOOST_CHECK_EQUAL(r.status_line, "HTTP/1.1 503 Service Unavailable");
+  BOOST_CHECK_EQUAL(r.header("connection"), "keep-alive");
+  c.send(get("/echo/3"));
+  BOOST_CHECK_EQUAL(c.read_reply().status_line, "HTTP/1.1 200 OK");
+}
+
+BOOST_AUTO_TEST_CASE(static_files_are_sent_whole)
+{
+  temp_doc_root root;
+  std::string content = file_content(200000);
+  root.write("big.txt", content);
+  root.write("small.txt", "small");
+  server_options options;
+  options.sendfile_chunk_size = 16384;
+  running_server s(options, root.path());
+  client c;
+  // The reply after the file must follow all of the file.
+  c.send(get("/big.txt") + get("/small.txt"));
+  response r = c.read_reply();
+  BOOST_CHECK_EQUAL(r.status_line, "HTTP/1.1 200 OK");
+  BOOST_CHECK_EQUAL(r.header("content-length"), "200000");
+  BOOST_CHECK(r.body == content);
+  r = c.read_reply();
+  BOOST_CHECK_EQUAL(r.status_line, "HTTP/1.1 200 OK");
+  BOOST_CHECK_EQUAL(r.body, "small");
+}
+
+BOOST_AUTO_TEST_CASE(only_regular_files_are_served)
+{
+  temp_doc_root root;
+  root.mkdir("dir.txt");
+  running_server s(server_options(), root.path());
+  client c;
+  c.send(get("/missing.txt"));
+  BOOST_CHECK_EQUAL(c.read_reply().status_line, "HTTP/1.1 404 Not Found");
+  c.send(get("/dir.txt"));
+  BOOST_CHECK_EQUAL(c.read_reply().status_line, "HTTP/1.1 404 Not Found");
+}
+
+BOOST_AUTO_TEST_CASE(small_files_are_served_from_the_cache)
+{
+  temp_doc_root root;
+  root.write("a.txt", "cached");
+  running_server s(server_options(), root.path());
+  client c;
+  c.send(get("/a.txt"));
+  response first = c.read_reply();
+  std::size_t hits = status_count("File Cache Hits");
+  c.send(get("/a.txt"));
+  response second = c.read_reply();
+  BOOST_CHECK_EQUAL(status_count("File Cache Hits"), hits + 1);
+  BOOST_CHECK_EQUAL(second.body, "cached");
+  BOOST_CHECK_EQUAL(second.header("content-type"), "text/plain");
+  BOOST_CHECK_EQUAL(second.header("etag"), first.header("etag"));
+  BOOST_CHECK_EQUAL(second.header("last-modified"), first.header("last-modified"));
+}
+
+BOOST_AUTO_TEST_CASE(changed_files_are_not_served_stale)
+{
+  temp_doc_root root;
+  root.write("a.txt", "one");
+  running_server s(server_options(), root.path());
+  client c;
+  c.send(get("/a.txt"));
+  BOOST_CHECK_EQUAL(c.read_reply().body, "one");
+  c.send(get("/a.txt"));
+  BOOST_CHECK_EQUAL(c.read_reply().body, "one");
+
+  root.write("a.txt", "two!");
+  boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
+  c.send(get("/a.txt"));
+  BOOST_CHECK_EQUAL(c.read_reply().body, "two!");
+  c.send(get("/a.txt"));
+  BOOST_CHECK_EQUAL(c.read_reply().body, "two!");
+
+  root.write("b.txt", "three");
+  root.rename("b.txt", "a.txt");
+  boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
+  c.send(get("/a.txt"));
+  BOOST_CHECK_EQUAL(c.read_reply().body, "three");
+  BOOST_CHECK(status_count("File Cache Invalidations") >= 2);
+}
+
+BOOST_AUTO_TEST_CASE(the_cache_stays_within_its_budget)
+{
+  temp_doc_root root;
+  root.write("a.txt", file_content(6000));
+  root.write("b.txt", file_content(6000));
+  server_options options;
+  options.file_cache_bytes = 10000;
+  options.file_cache_shards = 1;
+  running_server s(options, root.path());
+  client c;
+  c.send(get("/a.txt"));
+  c.read_reply();
+  c.send(get("/b.txt"));
+  c.read_reply();
+  BOOST_CHECK_EQUAL(status_count("File Cache Evictions"), 1u);
+  c.send(get("/a.txt"));
+  BOOST_CHECK(c.read_reply().body == file_content(6000));
+}
+
+BOOST_AUTO_TEST_CASE(unchanged_files_get_304)
+{
+  temp_doc_root root;
+  root.write("a.txt", "content");
+  // Once served from the cache and once streamed.
+  for (int cached = 0; cached < 2; ++cached)
+  {
+    server_options options;
+    if (!cached)
+      options.file_cache_bytes = 0;
+    running_server s(options, root.path());
+    client c;
+    c.send(get("/a.txt"));
+    response r = c.read_reply();
+    std::string etag = r.header("etag");
+    std::string last_modified = r.header("last-modified");
+    BOOST_REQUIRE(!etag.empty());
+    BOOST_REQUIRE(!last_modified.empty());
+
+    const std::string matching[] =
+    {
+      "If-None-Match: " + etag + "\r\n",
+      "If-None-Match: \"other\", W/" + etag + "\r\n",
+      "If-None-Match: *\r\n",
+      "If-Modified-Since: " + last_modified + "\r\n"
+    };
+    for (std::size_t i = 0; i < sizeof(matching) / sizeof(matching[0]); ++i)
+    {
+      c.send(get("/a.txt", matching[i]));
+      r = c.read_reply();
+      BOOST_CHECK_MESSAGE(r.status_line == "HTTP/1.1 304 Not Modified", matching[i]);
+      BOOST_CHECK_EQUAL(r.header("etag"), etag);
+      BOOST_CHECK_EQUAL(r.header("last-modified"), last_modified);
+      BOOST_CHECK(r.body.empty());
+    }
+
+    // If-None-Match takes precedence over If-Modified-Since.
+    c.send(get("/a.txt", "If-None-Match: \"other\"\r\n"
+          "If-Modified-Since: " + last_modified + "\r\n"));
+    r = c.read_reply();
+    BOOST_CHECK_EQUAL(r.status_line, "HTTP/1.1 200 OK");
+    BOOST_CHECK_EQUAL(r.body, "content");
+    c.send(get("/a.txt", "If-Modified-Since: Thu, 01 Jan 1970 00:00:00 GMT\r\n"));
+    BOOST_CHECK_EQUAL(c.read_reply().status_line, "HTTP/1.1 200 OK");
+  }
+}
+
+BOOST_AUTO_TEST_CASE(byte_ranges_get_206)
+{
+  temp_doc_root root;
+  std::string content = file_content(1000);
+  root.write("a.txt", content);
+  for (int cached = 0; cached < 2; ++cached)
+  {
+    server_options options;
+    options.max_ranges = 3;
+    if (!cached)
+      options.file_cache_bytes = 0;
+    running_server s(options, root.path());
+    client c;
+    c.send(get("/a.txt"));
+    response whole = c.read_reply();
+    BOOST_CHECK_EQUAL(whole.header("accept-ranges"), "bytes");
+
+    c.send(get("/a.txt", "Range: bytes=10-19\r\n"));
+    response r = c.read_reply();
+    BOOST_CHECK_EQUAL(r.status_line, "HTTP/1.1 206 Partial Content");
+    BOOST_CHECK_EQUAL(r.header("content-range"), "bytes 10-19/1000");
+    BOOST_CHECK_EQUAL(r.body, content.substr(10, 10));
+
+    c.send(get("/a.txt", "Range: bytes=-5\r\n"));
+    r = c.read_reply();
+    BOOST_CHECK_EQUAL(r.header("content-range"), "bytes 995-999/1000");
+    BOOST_CHECK_EQUAL(r.body, content.substr(995));
+
+    c.send(get("/a.txt", "Range: bytes=990-\r\n"));
+    BOOST_CHECK_EQUAL(c.read_reply().body, content.substr(990));
+
+    c.send(get("/a.txt", "Range: bytes=0-1, 500-502\r\n"));
+    r = c.read_reply();
+    BOOST_CHECK_EQUAL(r.status_line, "HTTP/1.1 206 Partial Content");
+    std::string type = r.header("content-type");
+    std::string prefix = "multipart/byteranges; boundary=";
+    BOOST_REQUIRE_EQUAL(type.compare(0, prefix.size(), prefix), 0);
+    std::string boundary = type.substr(prefix.size());
+    BOOST_CHECK_EQUAL(r.body,
+        "--" + boundary + "\r\nContent-Type: text/plain\r\n"
+        "Content-Range: bytes 0-1/1000\r\n\r\n" + content.substr(0, 2)
+        + "\r\n--" + boundary + "\r\nContent-Type: text/plain\r\n"
+        "Content-Range: bytes 500-502/1000\r\n\r\n" + content.substr(500, 3)
+        + "\r\n--" + boundary + "--\r\n");
+
+    c.send(get("/a.txt", "Range: bytes=2000-3000\r\n"));
+    r = c.read_reply();
+    BOOST_CHECK_EQUAL(r.status_line, "HTTP/1.1 416 Range Not Satisfiable");
+    BOOST_CHECK_EQUAL(r.header("content-range"), "bytes */1000");
+
+    // Too many ranges, a stale If-Range or a malformed range get the whole
+    // file.
+    const std::string whole_file[] =
+    {
+      "Range: bytes=0-1,2-3,4-5,6-7\r\n",
+      "Range: bytes=0-1\r\nIf-Range: \"stale\"\r\n",
+      "Range: bytes=5-1\r\n"
+    };
+    for (std::size_t i = 0; i < sizeof(whole_file) / sizeof(whole_file[0]); ++i)
+    {
+      c.send(get("/a.txt", whole_file[i]));
+      r = c.read_reply();
+      BOOST_CHECK_MESSAGE(r.status_line == "HTTP/1.1 200 OK", whole_file[i]);
+      BOOST_CHECK(r.body == content);
+    }
+
+    c.send(get("/a.txt", "Range: bytes=0-1\r\nIf-Range: " + whole.header("etag") + "\r\n"));
+    BOOST_CHECK_EQUAL(c.read_reply().status_line, "HTTP/1.1 206 Partial Content");
+  }
+}
+
+BOOST_AUTO_TEST_CASE(accept_encoding_qualities)
+{
+  BOOST_CHECK_EQUAL(content_coding::quality("gzip, br", "gzip"), 1.0);
+  BOOST_CHECK_EQUAL(content_coding::quality("gzip;q=0.5, br", "gzip"), 0.5);
+  BOOST_CHECK_EQUAL(content_coding::quality("gzip;q=0, *", "gzip"), 0.0);
+  BOOST_CHECK_EQUAL(content_coding::quality("*;q=0.3", "br"), 0.3);
+  BOOST_CHECK_EQUAL(content_coding::quality("deflate", "gzip"), 0.0);
+  BOOST_CHECK_EQUAL(content_coding::quality("GZIP", "gzip"), 1.0);
+}
+
+BOOST_AUTO_TEST_CASE(precompressed_siblings_are_preferred)
+{
+  temp_doc_root root;
+  root.write("a.js", "plain");
+  root.write("a.js.gz", "gzipped");
+  root.write("a.js.br", "brotli");
+  running_server s(server_options(), root.path());
+  client c;
+  c.send(get("/a.js", "Accept-Encoding: gzip, br\r\n"));
+  response r = c.read_reply();
+  BOOST_CHECK_EQUAL(r.body, "brotli");
+  BOOST_CHECK_EQUAL(r.header("content-encoding"), "br");
+  BOOST_CHECK_EQUAL(r.header("content-type"), "text/javascript");
+  BOOST_CHECK_EQUAL(r.header("vary"), "Accept-Encoding");
+
+  c.send(get("/a.js", "Accept-Encoding: gzip, br;q=0.5\r\n"));
+  r = c.read_reply();
+  BOOST_CHECK_EQUAL(r.body, "gzipped");
+  BOOST_CHECK_EQUAL(r.header("content-encoding"), "gzip");
+
+  c.send(get("/a.js"));
+  r = c.read_reply();
+  BOOST_CHECK_EQUAL(r.body, "plain");
+  BOOST_CHECK(r.header("content-encoding").empty());
+  BOOST_CHECK_EQUAL(r.header("vary"), "Accept-Encoding");
+
+  // Ranges are taken from the file itself.
+  c.send(get("/a.js", "Accept-Encoding: gzip\r\nRange: bytes=0-1\r\n"));
+  BOOST_CHECK_EQUAL(c.read_reply().body, "pl");
+}
+
+BOOST_AUTO_TEST_CASE(siblings_created_later_are_found)
+{
+  // A cached file remembered to have no siblings must find one created
+  // after it was cached.
+  temp_doc_root root;
+  root.write("a.js", "plain");
+  running_server s(server_options(), root.path());
+  client c;
+  for (int i = 0; i < 2; ++i)
+  {
+    c.send(get("/a.js", "Accept-Encoding: gzip\r\n"));
+    BOOST_CHECK_EQUAL(c.read_reply().body, "plain");
+  }
+  root.write("a.js.gz", "gzipped");
+  boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
+  c.send(get("/a.js", "Accept-Encoding: gzip\r\n"));
+  BOOST_CHECK_EQUAL(c.read_reply().body, "gzipped");
+}
+
+BOOST_AUTO_TEST_CASE(cached_files_and_handler_output_are_compressed)
+{
+  temp_doc_root root;
+  std::string content = file_content(20000);
+  root.write("a.txt", content);
+  root.write("small.txt", "small");
+  running_server s(server_options(), root.path());
+  client c;
+  for (int i = 0; i < 2; ++i)
+  {
+    c.send(get("/a.txt", "Accept-Encoding: gzip\r\n"));
+    response r = c.read_reply();
+    BOOST_CHECK_EQUAL(r.header("content-encoding"), "gzip");
+    BOOST_CHECK_EQUAL(r.header("vary"), "Accept-Encoding");
+    BOOST_CHECK(r.body.size() < content.size());
+    BOOST_CHECK(gunzip(r.body) == content);
+  }
+
+  c.send(get("/small.txt", "Accept-Encoding: gzip\r\n"));
+  response r = c.read_reply();
+  BOOST_CHECK(r.header("content-encoding").empty());
+  BOOST_CHECK_EQUAL(r.body, "small");
+
+  std::string data = file_content(5000);
+  c.send("POST /echo HTTP/1.1\r\nHost: localhost\r\nAccept-Encoding: gzip\r\n"
+      "Content-Type: text/plain\r\nContent-Length: 5000\r\n\r\n" + data);
+  r = c.read_reply();
+  BOOST_CHECK_EQUAL(r.header("content-encoding"), "gzip");
+  BOOST_CHECK(gunzip(r.body).find(data) != std::string::npos);
+  BOOST_CHECK(status_count("Compressed Replies") >= 3);
+}
+
+BOOST_AUTO_TEST_CASE(streamed_replies_are_chunked)
+{
+  running_server s;
+  std::shared_ptr<counting_stream_handler> handler(new counting_stream_handler(100, 4096));
+  s.get().register_handler(handler);
+  client c;
+  // Well past the high water mark, the producer has to wait for the
+  // connection to catch up.
+  for (int i = 0; i < 2; ++i)
+  {
+    c.send(get("/stream"));
+    response r = c.read_reply();
+    BOOST_CHECK_EQUAL(r.status_line, "HTTP/1.1 200 OK");
+    BOOST_CHECK_EQUAL(r.header("transfer-encoding"), "chunked");
+    BOOST_CHECK(r.headers.count("content-length") == 0);
+    BOOST_CHECK(r.chunks > 1);
+    BOOST_CHECK(r.body == handler->body());
+  }
+  c.send(get("/echo"));
+  BOOST_CHECK_EQUAL(c.read_reply().status_line, "HTTP/1.1 200 OK");
+}
+
+BOOST_AUTO_TEST_CASE(streamed_replies_to_http_1_0_end_with_the_connection)
+{
+  running_server s;
+  std::shared_ptr<counting_stream_handler> handler(new counting_stream_handler(10, 1000));
+  s.get().register_handler(handler);
+  client c;
+  c.send("GET /stream HTTP/1.0\r\nConnection: keep-alive\r\n\r\n");
+  response r = c.read_reply();
+  BOOST_CHECK_EQUAL(r.status_line, "HTTP/1.1 200 OK");
+  BOOST_CHECK(r.header("transfer-encoding").empty());
+  BOOST_CHECK(r.body == handler->body());
+}
+
+BOOST_AUTO_TEST_CASE(deferred_replies_keep_their_place)
+{
+  running_server s;
+  std::shared_ptr<delayed_handler> handler(new delayed_handler(100));
+  s.get().register_handler(handler);
+  client c;
+  c.send(get("/later/1") + get("/echo/2") + get("/later/3"));
+  response r = c.read_reply();
+  BOOST_CHECK_EQUAL(r.status_line, "HTTP/1.1 200 OK");
+  BOOST_CHECK_EQUAL(r.body, "/later/1");
+  BOOST_CHECK(c.read_reply().body.find("/echo/2") != std::string::npos);
+  BOOST_CHECK_EQUAL(c.read_reply().body, "/later/3");
+}
+
+BOOST_AUTO_TEST_CASE(handlers_that_never_complete_time_out)
+{
+  server_options options;
+  options.handler_timeout_ms = 200;
+  options.timer_tick_ms = 10;
+  running_server s(options);
+  std::shared_ptr<delayed_handler> handler(new delayed_handler(-1));
+  s.get().register_handler(handler);
+  client c;
+  c.send(get("/later"));
+  BOOST_CHECK(c.closed());
+  for (int i = 0; i < 50 && handler->cancelled() == 0; ++i)
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+  BOOST_CHECK_EQUAL(handler->cancelled(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(worker_queue_overflow_gets_503)
+{
+  server_options options;
+  options.worker_threads = 1;
+  options.worker_queue_limit = 1;
+  running_server s(options);
+  s.get().register_handler(std::shared_ptr<registered_handler>(new slow_worker_handler(300)));
+  client running, queued, rejected;
+  running.send(get("/work/1"));
+  boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
+  queued.send(get("/work/2"));
+  boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
+  rejected.send(get("/work/3"));
+  response r = rejected.read_reply();
+  BOOST_CHECK_EQUAL(r.status_line, "HTTP/1.1 503 Service Unavailable");
+  BOOST_CHECK(!r.header("retry-after").empty());
+
+  // Other requests are still answered while the worker is busy.
+  client c;
+  c.send(get("/echo"));
+  BOOST_CHECK_EQUAL(c.read_reply().status_line, "HTTP/1.1 200 OK");
+
+  BOOST_CHECK_EQUAL(running.read_reply().body, "/work/1");
+  BOOST_CHECK_EQUAL(queued.read_reply().body, "/work/2");
+  BOOST_CHECK_EQUAL(status_count("Worker Tasks"), 2u);
+  BOOST_CHECK_EQUAL(status_count("Worker Rejected"), 1u);
+}
+
+BOOST_AUTO_TEST_CASE(coroutines_wait_without_blocking)
+{
+  running_server s;
+  s.get().register_handler(std::shared_ptr<registered_handler>(new waiting_coroutine_handler(300)));
+  std::vector<boost::shared_ptr<client> > clients;
+  for (int i = 0; i < 10; ++i)
+    clients.push_back(boost::shared_ptr<client>(new client()));
+  // On two io threads blocking waits would take 1.5 seconds.
+  boost::chrono::steady_clock::time_point start = boost::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < clients.size(); ++i)
+    clients[i]->send(get("/wait/" + boost::lexical_cast<std::string>(i)));
+  for (std::size_t i = 0; i < clients.size(); ++i)
+    BOOST_CHECK_EQUAL(clients[i]->read_reply().body, "/wait/" + boost::lexical_cast<std::string>(i));
+  BOOST_CHECK(boost::chrono::steady_clock::now() - start < boost::chrono::milliseconds(1000));
+
+  clients[0]->send(get("/wait/throw"));
+  BOOST_CHECK_EQUAL(clients[0]->read_reply().status_line, "HTTP/1.1 500 Internal Server Error");
+  BOOST_CHECK_EQUAL(status_count("Coroutines Started"), 11u);
+  BOOST_CHECK_EQUAL(status_count("Coroutines Active"), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(request_bodies_are_streamed_to_handlers_asking_for_them)
+{
+  running_server s;
+  std::shared_ptr<upload_handler> handler(new upload_handler());
+  s.get().register_handler(handler);
+  client c;
+  std::string body = file_content(1024 * 1024);
+  c.send(post("/upload", body) + get("/echo/after"));
+  response r = c.read_reply();
+  BOOST_CHECK_EQUAL(r.status_line, "HTTP/1.1 200 OK");
+  BOOST_CHECK_EQUAL(r.body, upload_handler::summary(body));
+  BOOST_CHECK(c.read_reply().body.find("/echo/after") != std::string::npos);
+
+  // Other handlers still get the body in post.
+  c.send(post("/echo", std::string(100, 'p')));
+  BOOST_CHECK(c.read_reply().body.find(std::string(100, 'p')) != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(any_handler_may_stream_the_request_body)
+{
+  running_server s;
+  std::shared_ptr<counting_upload_handler> handler(new counting_upload_handler());
+  s.get().register_handler(handler);
+  client c;
+  c.send(post("/count", file_content(100000)) + get("/echo/after"));
+  BOOST_CHECK_EQUAL(c.read_reply().body, "counting");
+  BOOST_CHECK(c.read_reply().body.find("/echo/after") != std::string::npos);
+  for (int i = 0; i < 50 && handler->ended() == 0; ++i)
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+  BOOST_CHECK_EQUAL(handler->ended(), 1);
+  BOOST_CHECK_EQUAL(handler->received(), 100000u);
+
+  // A body the handler took no interest in is read and dropped.
+  c.send(post("/count?ignore", file_content(50000)) + get("/echo/again"));
+  BOOST_CHECK_EQUAL(c.read_reply().body, "counting");
+  BOOST_CHECK(c.read_reply().body.find("/echo/again") != std::string::npos);
+  BOOST_CHECK_EQUAL(handler->received(), 100000u);
+}
+
+BOOST_AUTO_TEST_CASE(streamed_bodies_cut_short_are_aborted)
+{
+  running_server s;
+  std::shared_ptr<upload_handler> handler(new upload_handler());
+  s.get().register_handler(handler);
+  {
+    client c;
+    c.send(post("/upload", std::string(10000, 'a')).substr(0, 5000));
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(50));
+  }
+  for (int i = 0; i < 50 && handler->aborted() == 0; ++i)
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+  BOOST_CHECK_EQUAL(handler->aborted(), 1);
+}
+
+
+BOOST_AUTO_TEST_CASE(large_bodies_are_spilled_to_a_file)
+{
+  server_options options;
+  options.body_spill_threshold = 10000;
+  options.body_spill_buffer_size = 4096;
+  running_server s(options);
+  s.get().register_handler(std::shared_ptr<registered_handler>(new body_summary_handler()));
+  client c;
+  std::string large = file_content(50000);
+  std::string small = file_content(5000);
+  c.send(post("/summary", large) + post("/summary", small));
+  BOOST_CHECK_EQUAL(c.read_reply().body, "file " + upload_handler::summary(large));
+  BOOST_CHECK_EQUAL(c.read_reply().body, "memory " + upload_handler::summary(small));
+  BOOST_CHECK_EQUAL(status_count("Spilled Request Bodies"), 1u);
+  BOOST_CHECK_EQUAL(status_count("Request Body Memory"), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(only_handlers_asking_for_it_get_a_body_file)
+{
+  server_options options;
+  options.body_spill_threshold = 10000;
+  running_server s(options);
+  client c;
+  std::string body = file_content(2 * 1024 * 1024);
+  c.send(post("/echo", body));
+  response r = c.read_reply();
+  BOOST_CHECK_EQUAL(r.status_line, "HTTP/1.1 200 OK");
+  BOOST_CHECK(r.body.find(body) != std::string::npos);
+  BOOST_CHECK_EQUAL(status_count("Spilled Request Bodies"), 0u);
+  BOOST_CHECK_EQUAL(status_count("Request Body Memory"), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(oversized_bodies_are_refused)
+{
+  server_options options;
+  options.max_body_size = 1000;
+  running_server s(options);
+  {
+    client c;
+    c.send(post("/echo", std::string(2000, 'a')));
+    response r = c.read_reply();
+    BOOST_CHECK_EQUAL(r.status_line, "HTTP/1.1 413 Payload Too Large");
+    BOOST_CHECK(c.closed());
+  }
+  // Nothing is reserved for a length nobody could send.
+  client c;
+  c.send("POST /echo HTTP/1.1\r\nHost: localhost\r\n"
+      "Content-Type: application/x-www-form-urlencoded\r\n"
+      "Content-Length: 1000000000000000\r\n\r\na=b");
+  BOOST_CHECK_EQUAL(c.read_reply().status_line, "HTTP/1.1 413 Payload Too Large");
+  BOOST_CHECK_EQUAL(status_count("Refused Request Bodies"), 2u);
+}
+
+BOOST_AUTO_TEST_CASE(bodies_held_in_memory_are_capped)
+{
+  server_options options;
+  options.max_body_memory = 1000;
+  running_server s(options);
+  std::string form = "POST /echo HTTP/1.1\r\nHost: localhost\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: ";
+  {
+    client c;
+    c.send(form + "2000\r\n\r\na=b");
+    BOOST_CHECK_EQUAL(c.read_reply().status_line, "HTTP/1.1 413 Payload Too Large");
+  }
+  {
+    // Nor is any other body for a handler not taking it in a file.
+    client c;
+    c.send("POST /echo HTTP/1.1\r\nHost: localhost\r\nContent-Length: 2000\r\n\r\nabc");
+    BOOST_CHECK_EQUAL(c.read_reply().status_line, "HTTP/1.1 413 Payload Too Large");
+  }
+
+  // A body that would fit once others are done has to wait.
+  client holding;
+  holding.send(form + "600\r\n\r\na=b");
+  boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
+  client waiting;
+  waiting.send(form + "600\r\n\r\na=b");
+  response r = waiting.read_reply();
+  BOOST_CHECK_EQUAL(r.status_line, "HTTP/1.1 503 Service Unavailable");
+  BOOST_CHECK(!r.header("retry-after").empty());
+  BOOST_CHECK(waiting.closed());
+
+  holding.send(std::string(597, 'c'));
+  BOOST_CHECK_EQUAL(holding.read_reply().status_line, "HTTP/1.1 200 OK");
+  BOOST_CHECK_EQUAL(status_count("Request Body Memory"), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(oversized_request_heads_get_431)
+{
+  server_options options;
+  options.max_header_size = 16384;
+  running_server s(options);
+  {
+    // Larger than a slab but within the limit.
+    client c;
+    c.send(get("/echo", "X-Large: " + std::string(12000, 'a') + "\r\n"));
+    BOOST_CHECK_EQUAL(c.read_reply().status_line, "HTTP/1.1 200 OK");
+  }
+  client c;
+  std::string head = "GET /echo HTTP/1.1\r\nHost: localhost\r\nX-Large: ";
+  c.send(head + std::string(options.max_header_size - head.size(), 'a'));
+  response r = c.read_reply();
+  BOOST_CHECK_EQUAL(r.status_line, "HTTP/1.1 431 Request Header Fields Too Large");
+  BOOST_CHECK(c.closed());
+  BOOST_CHECK_EQUAL(status_count("Oversized Request Heads"), 1u);
+}
+
+BOOST_AUTO_TEST_CASE(the_head_limit_does_not_count_the_body)
+{
+  server_options options;
+  options.max_header_size = 65536;
+  running_server s(options);
+  client c;
+  c.send("POST /echo HTTP/1.1\r\nHost: localhost\r\nX-Large: " + std::string(40000, 'a')
+      + "\r\nContent-Type: application/x-www-form-urlencoded\r\nContent-Length: 30000\r\n\r\n"
+      + "a=" + std::string(29998, 'b'));
+  BOOST_CHECK_EQUAL(c.read_reply().status_line, "HTTP/1.1 200 OK");
+  BOOST_CHECK_EQUAL(status_count("Oversized Request Heads"), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(idle_connections_hold_no_read_buffer)
+{
+  for (int release = 0; release != 2; ++release)
+  {
+    server_options options;
+    options.release_idle_buffers = release != 0;
+    running_server s(options);
+    std::vector<boost::shared_ptr<client> > clients;
+    for (int i = 0; i != 3; ++i)
+    {
+      clients.push_back(boost::make_shared<client>());
+      clients.back()->send(get("/echo"));
+      BOOST_CHECK_EQUAL(clients.back()->read_reply().status_line, "HTTP/1.1 200 OK");
+    }
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
+    BOOST_CHECK_EQUAL(status_count("Idle Connections"), 3u);
+    BOOST_CHECK_EQUAL(status_count("Read Buffer Memory per Idle Connection"),
+        release ? 0u : 8192u);
+
+    // Each takes a buffer again once its next request arrives.
+    for (std::size_t i = 0; i != clients.size(); ++i)
+    {
+      clients[i]->send(get("/echo"));
+      BOOST_CHECK_EQUAL(clients[i]->read_reply().status_line, "HTTP/1.1 200 OK");
+    }
+  }
+}
@@ -0,0 +1,134 @@
+//
+// timer_wheel.cpp
+// ~~~~~~~~~~~~~~~
+//
+
+#include "timer_wheel.hpp"
+#include <boost/bind.hpp>
+
+namespace http {
+namespace server {
+
+timer_wheel::timer_wheel(boost::asio::io_service& io_service,
+    std::size_t tick_ms)
+  : timer_(io_service),
+    tick_(std::chrono::milliseconds(tick_ms ? tick_ms : 1)),
+    current_(0),
+    size_(0)
+{
+}
+
+void timer_wheel::start()
+{
+  epoch_ = boost::asio::steady_timer::clock_type::now();
+  start_timer();
+}
+
+void timer_wheel::schedule(entry& e, std::size_t timeout_ms)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  if (e.hook_.is_linked())
+  {
+    e.hook_.unlink();
+    --size_;
+  }
+
+  // Round up so an entry never fires early.
+  boost::uint64_t ticks = (std::chrono::milliseconds(timeout_ms) + tick_ - boost::asio::steady_timer::duration(1)) / tick_;
+  e.expiry_ = current_ + (ticks ? ticks : 1);
+  insert(e);
+  ++size_;
+}
+
+void timer_wheel::cancel(entry& e)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  if (e.hook_.is_linked())
+  {
+    e.hook_.unlink();
+    --size_;
+  }
+}
+
+std::size_t timer_wheel::size()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return size_;
+}
+
+void timer_wheel::insert(entry& e)
+{
+  boost::uint64_t delta = e.expiry_ > current_ ? e.expiry_ - current_ : 0;
+  boost::uint64_t expiry = e.expiry_ > current_ ? e.expiry_ : current_;
+  for (std::size_t level = 0; level < levels; ++level)
+  {
+    if (delta < (boost::uint64_t(1) << (level_bits * (level + 1))) || level == levels - 1)
+    {
+      std::size_t index = (expiry >> (level_bits * level)) & (level_size - 1);
+      slots_[level][index].push_back(e);
+      return;
+    }
+  }
+}
+
+void timer_wheel::cascade(std::size_t level)
+{
+  std::size_t index = (current_ >> (level_bits * level)) & (level_size - 1);
+  slot pending;
+  pending.swap(slots_[level][index]);
+  while (!pending.empty())
+  {
+    entry& e = pending.front();
+    pending.pop_front();
+    insert(e);
+  }
+}
+
+void timer_wheel::advance()
+{
+  ++current_;
+
+  // Whenever a lower level wraps, the next slot of the level above is due to
+  // be spread over the levels below.
+  for (std::size_t level = 1; level < levels; ++level)
+  {
+    if ((current_ & ((boost::uint64_t(1) << (level_bits * level)) - 1)) != 0)
+      break;
+    cascade(level);
+  }
+
+  slot& due = slots_[0][current_ & (level_size - 1)];
+  while (!due.empty())
+  {
+    entry& e = due.front();
+    due.pop_front();
+    --size_;
+    e.expire();
+  }
+}
+
+void timer_wheel::start_timer()
+{
+  timer_.expires_at(epoch_ + tick_ * (current_ + 1));
+  timer_.async_wait(boost::bind(&timer_wheel::handle_tick, this,
+        boost::asio::placeholders::error));
+}
+
+void timer_wheel::handle_tick(const boost::system::error_code& e)
+{
+  if (e == boost::asio::error::operation_aborted)
+    return;
+
+  {
+    // Catch up on every tick that has elapsed, the timer may fire late.
+    boost::mutex::scoped_lock lock(mutex_);
+    boost::uint64_t now = (boost::asio::steady_timer::clock_type::now() - epoch_) / tick_;
+    while (current_ < now)
+      advance();
+  }
+
+  start_timer();
+}
+
+} // namespace server
+} // namespace http
@@ -0,0 +1,126 @@
+//
+// timer_wheel.hpp
+// ~~~~~~~~~~~~~~~
+//
+// Hierarchical timer wheel used for connection deadlines. One wheel and one
+// asio timer serve every connection of an io_service, so arming and
+// cancelling a deadline is O(1) no matter how many connections are open.
+//
+
+#ifndef HTTP_SERVER_TIMER_WHEEL_HPP
+#define HTTP_SERVER_TIMER_WHEEL_HPP
+
+#include <cstddef>
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/intrusive/list.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace http {
+namespace server {
+
+/// A timer wheel with a fixed tick. Deadlines are rounded up to the next
+/// tick.
+class timer_wheel
+  : private boost::noncopyable
+{
+public:
+  /// Something that can be scheduled on the wheel. An entry is on at most
+  /// one wheel at a time and must be cancelled before it is destroyed.
+  class entry
+    : private boost::noncopyable
+  {
+  public:
+    entry() : expiry_(0) { ; }
+    virtual ~entry() { ; }
+
+    /// Called with the wheel's lock held once the deadline has passed. Must
+    /// not schedule or cancel entries on the same wheel.
+    virtual void expire() = 0;
+
+  private:
+    friend class timer_wheel;
+
+    /// Link in the slot holding the entry.
+    boost::intrusive::list_member_hook<
+      boost::intrusive::link_mode<boost::intrusive::auto_unlink> > hook_;
+
+    /// Tick at which the entry expires.
+    boost::uint64_t expiry_;
+  };
+
+  /// Construct a wheel driven by a timer on the given io_service.
+  timer_wheel(boost::asio::io_service& io_service, std::size_t tick_ms);
+
+  /// Start ticking.
+  void start();
+
+  /// Arm or re-arm an entry to expire after the given number of
+  /// milliseconds.
+  void schedule(entry& e, std::size_t timeout_ms);
+
+  /// Disarm an entry. Does nothing if it is not armed.
+  void cancel(entry& e);
+
+  /// Number of armed entries.
+  std::size_t size();
+
+private:
+  typedef boost::intrusive::list<entry,
+          boost::intrusive::member_hook<entry,
+            boost::intrusive::list_member_hook<
+              boost::intrusive::link_mode<boost::intrusive::auto_unlink> >,
+            &entry::hook_>,
+          boost::intrusive::constant_time_size<false> > slot;
+
+  /// Each level has 2^level_bits slots, covering 2^(level_bits * levels)
+  /// ticks in total.
+  enum { level_bits = 6, level_size = 1 << level_bits, levels = 4 };
+
+  /// Put an entry in the slot matching its expiry. Requires the lock.
+  void insert(entry& e);
+
+  /// Move the entries of a higher level slot down to where they now belong.
+  /// Requires the lock.
+  void cascade(std::size_t level);
+
+  /// Advance one tick and expire the entries due. Requires the lock.
+  void advance();
+
+  /// Wait for the next tick.
+  void start_timer();
+
+  /// Handle the tick timer.
+  void handle_tick(const boost::system::error_code& e);
+
+  /// Timer driving the wheel.
+  boost::asio::steady_timer timer_;
+
+  /// Length of a tick.
+  boost::asio::steady_timer::duration tick_;
+
+  /// Time at which the wheel was started, ticks are counted from here.
+  boost::asio::steady_timer::time_point epoch_;
+
+  /// Protects the slots, entries are armed from any io thread.
+  boost::mutex mutex_;
+
+  /// The tick the wheel has advanced to.
+  boost::uint64_t current_;
+
+  /// Number of armed entries.
+  std::size_t size_;
+
+  /// The slots of every level.
+  slot slots_[levels][level_size];
+};
+
+typedef boost::shared_ptr<timer_wheel> timer_wheel_ptr;
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_SERVER_TIMER_WHEEL_HPP
@@ -0,0 +1,150 @@
+//
+// timer_wheel_test.cpp
+// ~~~~~~~~~~~~~~~~~~~~
+//
+// Arms, re-arms and cancels entries on a running wheel and checks when they
+// expire.
+//
+
+#define BOOST_TEST_MODULE timer_wheel_test
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/chrono.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+#include "timer_wheel.hpp"
+
+using namespace http::server;
+
+namespace {
+
+typedef boost::chrono::steady_clock clock_type;
+
+/// Records when it expired.
+class recorder : public timer_wheel::entry
+{
+public:
+  recorder() : expired_(0) { ; }
+
+  void expire()
+  {
+    expired_at_ = clock_type::now();
+    ++expired_;
+  }
+
+  int expired() const { return expired_; }
+
+  /// Milliseconds from start until the entry expired.
+  long elapsed_ms(clock_type::time_point start) const
+  {
+    return boost::chrono::duration_cast<boost::chrono::milliseconds>(
+        expired_at_ - start).count();
+  }
+
+private:
+  boost::atomic<int> expired_;
+  clock_type::time_point expired_at_;
+};
+
+/// A wheel ticking on an io_service run by a thread of its own.
+class running_wheel
+{
+public:
+  explicit running_wheel(std::size_t tick_ms)
+    : work_(new boost::asio::io_service::work(io_service_)),
+      wheel_(io_service_, tick_ms)
+  {
+    wheel_.start();
+    thread_ = boost::thread(boost::bind(&boost::asio::io_service::run, &io_service_));
+  }
+
+  ~running_wheel()
+  {
+    io_service_.stop();
+    thread_.join();
+  }
+
+  timer_wheel& get() { return wheel_; }
+
+private:
+  boost::asio::io_service io_service_;
+  boost::scoped_ptr<boost::asio::io_service::work> work_;
+  timer_wheel wheel_;
+  boost::thread thread_;
+};
+
+void sleep_ms(int ms)
+{
+  boost::this_thread::sleep_for(boost::chrono::milliseconds(ms));
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(entries_expire_after_their_timeout)
+{
+  running_wheel w(5);
+  recorder soon, later;
+  clock_type::time_point start = clock_type::now();
+  w.get().schedule(soon, 20);
+  w.get().schedule(later, 60);
+  BOOST_CHECK_EQUAL(w.get().size(), 2u);
+
+  sleep_ms(150);
+  BOOST_CHECK_EQUAL(soon.expired(), 1);
+  BOOST_CHECK_EQUAL(later.expired(), 1);
+  // Timeouts count from the current tick, so may end up to a tick early.
+  BOOST_CHECK(soon.elapsed_ms(start) >= 20 - 5);
+  BOOST_CHECK(later.elapsed_ms(start) >= 60 - 5);
+  BOOST_CHECK(soon.elapsed_ms(start) < later.elapsed_ms(start));
+  BOOST_CHECK_EQUAL(w.get().size(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(cancelled_entries_do_not_expire)
+{
+  running_wheel w(5);
+  recorder r;
+  w.get().schedule(r, 20);
+  w.get().cancel(r);
+  BOOST_CHECK_EQUAL(w.get().size(), 0u);
+  // Cancelling an entry that is not armed does nothing.
+  w.get().cancel(r);
+  sleep_ms(80);
+  BOOST_CHECK_EQUAL(r.expired(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(rearming_moves_the_deadline)
+{
+  running_wheel w(5);
+  recorder r;
+  clock_type::time_point start = clock_type::now();
+  w.get().schedule(r, 20);
+  w.get().schedule(r, 100);
+  BOOST_CHECK_EQUAL(w.get().size(), 1u);
+  sleep_ms(60);
+  BOOST_CHECK_EQUAL(r.expired(), 0);
+  sleep_ms(120);
+  BOOST_CHECK_EQUAL(r.expired(), 1);
+  BOOST_CHECK(r.elapsed_ms(start) >= 100 - 5);
+}
+
+BOOST_AUTO_TEST_CASE(entries_past_the_first_level_cascade_down)
+{
+  // With 1 ms ticks the first level covers 64 ms, these sit on the second
+  // level until they are due.
+  running_wheel w(1);
+  recorder a, b;
+  clock_type::time_point start = clock_type::now();
+  w.get().schedule(a, 150);
+  w.get().schedule(b, 700);
+  sleep_ms(400);
+  BOOST_CHECK_EQUAL(a.expired(), 1);
+  BOOST_CHECK_EQUAL(b.expired(), 0);
+  BOOST_CHECK(a.elapsed_ms(start) >= 150 - 1);
+  sleep_ms(500);
+  BOOST_CHECK_EQUAL(b.expired(), 1);
+  BOOST_CHECK(b.elapsed_ms(start) >= 700 - 1);
+}
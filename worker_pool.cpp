@@ -0,0 +1,88 @@
+//
+// worker_pool.cpp
+// ~~~~~~~~~~~~~~~
+//
+
+#include "worker_pool.hpp"
+#include <boost/bind.hpp>
+
+namespace http {
+namespace server {
+
+worker_pool::worker_pool(std::size_t threads, std::size_t max_queue,
+    server_stats& stats)
+  : thread_count_(threads),
+    max_queue_(max_queue),
+    stats_(stats),
+    depth_(0)
+{
+}
+
+worker_pool::~worker_pool()
+{
+  stop();
+  join();
+}
+
+bool worker_pool::post(const boost::function<void()>& task)
+{
+  // The depth is bumped before checking, so concurrent posts can not both
+  // take the last free place.
+  if (++depth_ > max_queue_)
+  {
+    --depth_;
+    ++stats_.worker_rejected;
+    return false;
+  }
+
+  io_service_.post(boost::bind(&worker_pool::run_task, this, task, clock::now()));
+  return true;
+}
+
+void worker_pool::start()
+{
+  if (!threads_.empty())
+    return;
+
+  io_service_.reset();
+  work_.reset(new boost::asio::io_service::work(io_service_));
+  for (std::size_t i = 0; i < thread_count_; ++i)
+  {
+    boost::shared_ptr<boost::thread> thread(new boost::thread(
+          boost::bind(&boost::asio::io_service::run, &io_service_)));
+    threads_.push_back(thread);
+  }
+}
+
+void worker_pool::stop()
+{
+  io_service_.stop();
+}
+
+void worker_pool::join()
+{
+  for (std::size_t i = 0; i < threads_.size(); ++i)
+    threads_[i]->join();
+  threads_.clear();
+  work_.reset();
+}
+
+void worker_pool::run_task(const boost::function<void()>& task,
+    clock::time_point queued)
+{
+  --depth_;
+  std::size_t waited = std::chrono::duration_cast<std::chrono::microseconds>(
+      clock::now() - queued).count();
+  ++stats_.worker_tasks;
+  stats_.worker_wait_us += waited;
+  std::size_t longest = stats_.worker_max_wait_us;
+  while (waited > longest
+      && !stats_.worker_max_wait_us.compare_exchange_weak(longest, waited))
+  {
+  }
+
+  task();
+}
+
+} // namespace server
+} // namespace http
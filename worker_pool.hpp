@@ -0,0 +1,89 @@
+//
+// worker_pool.hpp
+// ~~~~~~~~~~~~~~~
+//
+// Threads running CPU heavy handlers away from the io threads.
+//
+
+#ifndef HTTP_SERVER_WORKER_POOL_HPP
+#define HTTP_SERVER_WORKER_POOL_HPP
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include "server_stats.hpp"
+
+namespace http {
+namespace server {
+
+/// A fixed set of threads with a bounded queue of tasks. A burst of
+/// expensive requests queues here instead of occupying the threads that
+/// accept, read and write.
+class worker_pool
+  : private boost::noncopyable
+{
+public:
+  /// Construct a pool of the given number of threads, queueing at most
+  /// max_queue tasks. A pool without threads runs nothing.
+  worker_pool(std::size_t threads, std::size_t max_queue, server_stats& stats);
+
+  /// Stop the threads, abandoning queued tasks.
+  ~worker_pool();
+
+  /// Whether the pool has threads to run tasks.
+  bool enabled() const { return thread_count_ != 0; }
+
+  /// Queue a task. Returns false without queueing it when the queue is full.
+  bool post(const boost::function<void()>& task);
+
+  /// Start the threads.
+  void start();
+
+  /// Stop the threads, abandoning queued tasks. Safe to call from any
+  /// thread, including a worker.
+  void stop();
+
+  /// Wait for the threads to exit after stop.
+  void join();
+
+  /// Number of tasks queued and not yet started.
+  std::size_t queue_depth() const { return depth_; }
+
+private:
+  typedef std::chrono::steady_clock clock;
+
+  /// Run a task, recording how long it waited in the queue.
+  void run_task(const boost::function<void()>& task, clock::time_point queued);
+
+  /// Number of threads to run.
+  std::size_t thread_count_;
+
+  /// Most tasks queued at once.
+  std::size_t max_queue_;
+
+  /// Counters of the server.
+  server_stats& stats_;
+
+  /// Queue of tasks, run by the threads.
+  boost::asio::io_service io_service_;
+
+  /// Keeps the threads running while the queue is empty.
+  boost::scoped_ptr<boost::asio::io_service::work> work_;
+
+  /// The running threads.
+  std::vector<boost::shared_ptr<boost::thread> > threads_;
+
+  /// Tasks queued and not yet started.
+  std::atomic<std::size_t> depth_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_SERVER_WORKER_POOL_HPP